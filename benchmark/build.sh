@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+set -e
+mkdir -p build
+pushd build
+cmake ..
+make -j4
+popd
+./build/benchmark
+./build/hugepages
+./build/forking
+./build/snapshots
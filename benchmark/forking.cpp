@@ -0,0 +1,59 @@
+#include <libriscv/fork_pool.hpp>
+#include <chrono>
+#include <cstdio>
+
+using namespace riscv;
+static const std::vector<uint8_t> empty {};
+
+template <typename Callback>
+static double measure(const char* name, int rounds, Callback callback)
+{
+	const auto t0 = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < rounds; i++)
+		callback();
+	const auto t1 = std::chrono::high_resolution_clock::now();
+	const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds;
+	printf("%-28s %10.1f ns\n", name, ns);
+	return ns;
+}
+
+static void run(size_t pages)
+{
+	Machine<RISCV64> master { empty, MachineOptions<RISCV64>{ .memory_max = 0 } };
+	for (size_t i = 0; i < pages; i++)
+		master.memory.write<uint64_t> (0x100000 + i * Page::size(), i);
+
+	printf("* Master with %zu pages\n", master.memory.pages_active());
+	measure("eager fork", 200, [&] {
+		Machine<RISCV64> fork { empty, MachineOptions<RISCV64>{ .owning_machine = &master } };
+	});
+	measure("lazy fork", 200, [&] {
+		Machine<RISCV64> fork { empty, MachineOptions<RISCV64>{
+			.owning_machine = &master, .lazy_fork = true } };
+	});
+	ForkPool<RISCV64> pool { master, 16 };
+	std::vector<ForkPool<RISCV64>::machine_ptr> forks;
+	forks.reserve(pool.capacity());
+	measure("pool acquire", pool.capacity(), [&] {
+		forks.push_back(pool.acquire());
+	});
+	for (auto& fork : forks)
+		pool.release(std::move(fork));
+	measure("pool acquire + release", 200, [&] {
+		pool.release(pool.acquire());
+	});
+	Machine<RISCV64> fork { empty, MachineOptions<RISCV64>{
+		.owning_machine = &master, .lazy_fork = true } };
+	measure("write 16 pages + reset", 200, [&] {
+		for (size_t i = 0; i < 16; i++)
+			fork.memory.write<uint64_t> (0x100000 + i * Page::size(), i);
+		fork.reset_to_parent();
+	});
+}
+
+int main()
+{
+	for (size_t pages : { 16, 1024, 16384 })
+		run(pages);
+	return 0;
+}
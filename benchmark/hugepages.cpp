@@ -0,0 +1,95 @@
+#include <libriscv/machine.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace riscv;
+static const std::vector<uint8_t> empty {};
+static constexpr uint64_t MEMORY = 512ull << 20;
+static constexpr size_t ACCESSES = 20'000'000;
+
+// host dTLB load misses of this thread, or -1 when not available
+static int open_dtlb_counter()
+{
+	struct perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// kB of huge pages mapped by this process
+static long huge_kb()
+{
+	std::ifstream smaps("/proc/self/smaps_rollup");
+	std::string line;
+	long total = 0;
+	while (std::getline(smaps, line)) {
+		if (line.rfind("AnonHugePages:", 0) == 0 || line.rfind("ShmemPmdMapped:", 0) == 0)
+			total += std::stol(line.substr(line.find(':') + 1));
+	}
+	return total;
+}
+
+static void run(bool hugepages)
+{
+	MachineOptions<RISCV64> options { .memory_max = MEMORY };
+	options.linear_memory = MEMORY;
+	options.use_hugepages = hugepages;
+	Machine<RISCV64> machine { empty, options };
+	auto& mem = machine.memory;
+	// touch all of the memory first
+	for (uint64_t addr = 0x1000; addr < MEMORY - 0x1000; addr += 0x1000)
+		mem.write<uint64_t> (addr, addr);
+
+	const int fd = open_dtlb_counter();
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	const auto t0 = std::chrono::high_resolution_clock::now();
+	// random accesses all over the guest memory
+	uint64_t state = 12345, sum = 0;
+	for (size_t i = 0; i < ACCESSES; i++) {
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		const uint64_t addr = 0x1000 + ((state >> 16) % (MEMORY - 0x3000) & ~7ull);
+		sum += mem.read<uint64_t> (addr);
+		mem.write<uint64_t> (addr, sum);
+	}
+	const auto t1 = std::chrono::high_resolution_clock::now();
+	long long misses = -1;
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+			misses = -1;
+		close(fd);
+	}
+	const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / ACCESSES;
+	printf("%-12s %6.2f ns/access  huge pages: %6ld kB  dTLB misses: ",
+		hugepages ? "hugepages" : "regular", ns, huge_kb());
+	if (misses >= 0)
+		printf("%lld (%.3f per access)\n", misses, (double) misses / ACCESSES);
+	else
+		printf("n/a\n");
+	(void) sum;
+}
+
+int main()
+{
+	printf("* Random 8-byte accesses in %llu MiB of linear memory\n",
+		(unsigned long long) (MEMORY >> 20));
+	run(false);
+	run(true);
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include <libriscv/machine.hpp>
+#include <chrono>
+#include <cstdio>
+
+using namespace riscv;
+static const std::vector<uint8_t> empty {};
+
+template <typename Callback>
+static double measure(const char* name, size_t bytes, int rounds, Callback callback)
+{
+	const auto t0 = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < rounds; i++)
+		callback();
+	const auto t1 = std::chrono::high_resolution_clock::now();
+	const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds;
+	printf("%-28s %10.1f ns  %6.2f GB/s\n", name, ns, bytes / ns);
+	return ns;
+}
+
+// byte by byte through the guest page lookups, for comparison
+template <int W>
+static size_t bytewise_strlen(Machine<W>& m, address_type<W> addr, size_t maxlen)
+{
+	size_t len = 0;
+	while (len < maxlen && m.memory.template read<uint8_t> (addr + len) != 0)
+		len++;
+	return len;
+}
+template <int W>
+static int bytewise_memcmp(Machine<W>& m, address_type<W> p1, address_type<W> p2, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		const uint8_t v1 = m.memory.template read<uint8_t> (p1 + i);
+		const uint8_t v2 = m.memory.template read<uint8_t> (p2 + i);
+		if (v1 != v2) return v1 - v2;
+	}
+	return 0;
+}
+
+int main()
+{
+	Machine<RISCV64> machine { empty };
+	auto& mem = machine.memory;
+	volatile size_t sink = 0;
+
+	// strings that cross page boundaries
+	const uint64_t STR = 0x100F00;
+	const std::string text(12000, 'x');
+	mem.memcpy(STR, text.c_str(), text.size() + 1);
+	const uint64_t KEY = 0x120FF0;
+	const std::string key = "a.key.crossing.a.page.boundary";
+	mem.memcpy(KEY, key.c_str(), key.size() + 1);
+	// equal ranges at different page offsets
+	const uint64_t CMP1 = 0x200100;
+	const uint64_t CMP2 = 0x300F80;
+	const std::vector<uint8_t> data(16384, 0x5A);
+	mem.memcpy(CMP1, data.data(), data.size());
+	mem.memcpy(CMP2, data.data(), data.size());
+
+	printf("* Short strings (%zu bytes)\n", key.size());
+	measure("memstring", key.size(), 200000, [&] {
+		sink += mem.memstring(KEY, 4096).size();
+	});
+	measure("bytewise strlen", key.size(), 200000, [&] {
+		sink += bytewise_strlen(machine, KEY, 4096);
+	});
+
+	printf("* Long strings (%zu bytes)\n", text.size());
+	measure("strlen", text.size(), 20000, [&] {
+		sink += mem.strlen(STR, 16384);
+	});
+	measure("memstring", text.size(), 20000, [&] {
+		sink += mem.memstring(STR, 16384).size();
+	});
+	measure("bytewise strlen", text.size(), 2000, [&] {
+		sink += bytewise_strlen(machine, STR, 16384);
+	});
+
+	printf("* Compare (%zu bytes)\n", data.size());
+	measure("memcmp guest-guest", data.size(), 20000, [&] {
+		sink += mem.memcmp(CMP1, CMP2, data.size());
+	});
+	measure("memcmp host-guest", data.size(), 20000, [&] {
+		sink += mem.memcmp(data.data(), CMP2, data.size());
+	});
+	measure("bytewise memcmp", data.size(), 1000, [&] {
+		sink += bytewise_memcmp(machine, CMP1, CMP2, data.size());
+	});
+	(void) sink;
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include <libriscv/machine.hpp>
+#include <libriscv/mapped_file.hpp>
+#include <chrono>
+#include <cstdio>
+
+using namespace riscv;
+static const std::vector<uint8_t> empty {};
+
+template <typename Callback>
+static double measure(const char* name, int rounds, Callback callback)
+{
+	const auto t0 = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < rounds; i++)
+		callback();
+	const auto t1 = std::chrono::high_resolution_clock::now();
+	const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds;
+	printf("%-28s %10.1f us\n", name, ns / 1000.0);
+	return ns;
+}
+
+static void run(size_t pages)
+{
+	Machine<RISCV64> machine { empty, MachineOptions<RISCV64>{ .memory_max = 0 } };
+	for (size_t i = 0; i < pages; i++)
+		machine.memory.write<uint64_t> (0x100000 + i * Page::size(), i);
+
+	std::vector<uint8_t> snapshot;
+	machine.serialize_aligned_to(snapshot);
+	const char* path = "/tmp/riscv_snapshot.bin";
+	FILE* f = fopen(path, "wb");
+	if (f == nullptr || fwrite(snapshot.data(), 1, snapshot.size(), f) != snapshot.size())
+		throw std::runtime_error("Unable to write snapshot");
+	fclose(f);
+	MappedFile file { path };
+
+	printf("* Snapshot with %zu pages (%zu KiB)\n", pages, file.size() / 1024);
+	Machine<RISCV64> restored { empty, MachineOptions<RISCV64>{ .memory_max = 0 } };
+	measure("copying restore", 20, [&] {
+		restored.deserialize_from(snapshot);
+	});
+	measure("mapped restore", 20, [&] {
+		restored.deserialize_mapped(file.data(), file.size());
+	});
+	if (restored.memory.read<uint64_t> (0x100000 + (pages-1) * Page::size()) != pages-1)
+		throw std::runtime_error("Mapped restore failed");
+	measure("mapped restore + 16 writes", 20, [&] {
+		restored.deserialize_mapped(file.data(), file.size());
+		for (size_t i = 0; i < 16; i++)
+			restored.memory.write<uint64_t> (0x100000 + i * Page::size(), 0);
+	});
+	remove(path);
+}
+
+// a mix of zero, repeated, text-like and random pages
+static void fill(Machine<RISCV64>& machine, size_t pages)
+{
+	uint64_t x = 88172645463325252ull;
+	char text[64];
+	for (size_t i = 0; i < pages; i++) {
+		const uint64_t addr = 0x100000 + i * Page::size();
+		switch (i % 4) {
+		case 0: // zero
+			machine.memory.memset(addr, 0, Page::size());
+			break;
+		case 1: // repeated
+			machine.memory.memset(addr, i % 16, Page::size());
+			break;
+		case 2: // text
+			for (size_t off = 0; off < Page::size(); off += sizeof(text)) {
+				snprintf(text, sizeof(text), "entry %zu at offset %zu is %zu ;;;;;;;;;;;;;;;;;;;;;;;;;;;;", i, off, x % 1000);
+				machine.memory.memcpy(addr + off, text, sizeof(text));
+			}
+			break;
+		default: // random
+			for (size_t off = 0; off < Page::size(); off += 8) {
+				x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+				machine.memory.write<uint64_t> (addr + off, x);
+			}
+		}
+	}
+}
+
+static void run_compact(size_t pages)
+{
+	Machine<RISCV64> machine { empty, MachineOptions<RISCV64>{ .memory_max = 0 } };
+	fill(machine, pages);
+	const double mb = pages * Page::size() / 1e6;
+
+	printf("* Compact snapshot of %zu mixed pages\n", pages);
+	std::vector<uint8_t> plain, raw, compact;
+	const double t_plain = measure("serialize_to", 5, [&] {
+		plain.clear();
+		machine.serialize_to(plain);
+	});
+	SnapshotStats stats;
+	const double t_raw = measure("compact, no lz", 5, [&] {
+		raw.clear();
+		machine.serialize_compact_to(raw, false);
+	});
+	const double t_compact = measure("compact", 5, [&] {
+		compact.clear();
+		stats = machine.serialize_compact_to(compact);
+	});
+	printf("  %zu zero, %zu binary, %zu duplicate, %zu compressed\n",
+		stats.zero, stats.binary, stats.duplicate, stats.compressed);
+	Machine<RISCV64> restored { empty, MachineOptions<RISCV64>{ .memory_max = 0 } };
+	const double r_plain = measure("restore serialize_to", 5, [&] {
+		restored.deserialize_from(plain);
+	});
+	const double r_raw = measure("restore compact, no lz", 5, [&] {
+		restored.deserialize_from(raw);
+	});
+	const double r_compact = measure("restore compact", 5, [&] {
+		restored.deserialize_from(compact);
+	});
+	const auto report = [&] (const char* name, size_t size, double enc, double dec) {
+		printf("  %-16s %8zu KiB  encode %7.0f MB/s  decode %7.0f MB/s\n",
+			name, size / 1024, mb / (enc / 1e9), mb / (dec / 1e9));
+	};
+	report("plain", plain.size(), t_plain, r_plain);
+	report("compact, no lz", raw.size(), t_raw, r_raw);
+	report("compact", compact.size(), t_compact, r_compact);
+}
+
+int main()
+{
+	for (size_t pages : { 16, 1024, 16384 })
+		run(pages);
+	run_compact(16384);
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include <libriscv/machine.hpp>
+#include <libriscv/aot.hpp>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+static std::vector<uint8_t> load_file(const std::string&);
+
+// Translates the execute segment of a RISC-V binary into C++ and
+// compiles it into a shared object, to be loaded with the
+// MachineOptions::translation option.
+template <int W>
+static std::string translate(const std::vector<uint8_t>& binary)
+{
+	riscv::Machine<W> machine { binary, riscv::MachineOptions<W>{} };
+	return riscv::AOT<W>::translate(machine);
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s [RISC-V binary] [output.so]\n", argv[0]);
+		exit(1);
+	}
+	const std::string filename = argv[1];
+	const std::string output = argv[2];
+	const auto binary = load_file(filename);
+	if (binary.size() < 5 || binary[4] < 1 || binary[4] > 2) {
+		fprintf(stderr, "Not an ELF binary: %s\n", filename.c_str());
+		exit(1);
+	}
+	// ELF class in e_ident
+	const bool is64 = (binary[4] == 2);
+	const std::string source =
+		(is64) ? translate<riscv::RISCV64>(binary) : translate<riscv::RISCV32>(binary);
+
+	const std::string cppfile = output + ".cpp";
+	FILE* f = fopen(cppfile.c_str(), "wb");
+	if (f == NULL) throw std::runtime_error("Could not open file: " + cppfile);
+	fwrite(source.data(), 1, source.size(), f);
+	fclose(f);
+
+	// the paths are passed as they are, without a shell
+	const char* cxx = getenv("CXX");
+	if (cxx == nullptr) cxx = "c++";
+	const char* args[] = {
+		cxx, "-O2", "-shared", "-fPIC", "-o", output.c_str(), cppfile.c_str(), nullptr
+	};
+	printf("%s -O2 -shared -fPIC -o %s %s\n", cxx, output.c_str(), cppfile.c_str());
+	fflush(stdout);
+	const pid_t pid = fork();
+	if (pid < 0) throw std::runtime_error("Could not start the compiler");
+	if (pid == 0) {
+		execvp(cxx, (char* const*) args);
+		fprintf(stderr, "Could not run the compiler: %s\n", cxx);
+		_exit(127);
+	}
+	int status = 0;
+	if (waitpid(pid, &status, 0) < 0)
+		return 1;
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : 1;
+}
+
+std::vector<uint8_t> load_file(const std::string& filename)
+{
+    size_t size = 0;
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f == NULL) throw std::runtime_error("Could not open file: " + filename);
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    std::vector<uint8_t> result(size);
+    if (size != fread(result.data(), 1, size, f))
+    {
+        fclose(f);
+        throw std::runtime_error("Error when reading from file: " + filename);
+    }
+    fclose(f);
+    return result;
+}
@@ -12,34 +12,7 @@ static const uint64_t ARENA_BASE = 0x40000000;
 template <int W> address_type<W> machine_memcpy(
 	Machine<W>& m, address_type<W> dst, address_type<W> src, address_type<W> len)
 {
-	if ((dst & (W-1)) == (src & (W-1))) {
-		while ((src & (W-1)) != 0 && len > 0) {
-			m.memory.template write<uint8_t> (dst++,
-				m.memory.template read<uint8_t> (src++));
-			len --;
-		}
-		while (len >= 16) {
-			m.memory.template write<uint32_t> (dst + 0,
-				m.memory.template read<uint32_t> (src + 0));
-			m.memory.template write<uint32_t> (dst + 1*W,
-				m.memory.template read<uint32_t> (src + 1*W));
-			m.memory.template write<uint32_t> (dst + 2*W,
-				m.memory.template read<uint32_t> (src + 2*W));
-			m.memory.template write<uint32_t> (dst + 3*W,
-				m.memory.template read<uint32_t> (src + 3*W));
-			dst += 16; src += 16; len -= 16;
-		}
-		while (len >= W) {
-			m.memory.template write<uint32_t> (dst,
-				m.memory.template read<uint32_t> (src));
-			dst += W; src += W; len -= W;
-		}
-	}
-	while (len > 0) {
-		m.memory.template write<uint8_t> (dst++,
-			m.memory.template read<uint8_t> (src++));
-		len --;
-	}
+	m.memory.memmove_guest(dst, src, len);
 	return dst;
 }
 
@@ -66,8 +39,8 @@ static void setup_native_heap_syscalls(Machine<W>& machine,
 		auto data = arena->malloc(len);
 		SYSPRINT("SYSCALL calloc(%u, %u) = 0x%X\n", count, size, data);
 		if (data != 0) {
-			// TODO: optimize this (CoW), **can throw**
-			machine.memory.memset(data, 0, len);
+			// whole pages go back to the zero CoW page, **can throw**
+			machine.memory.zero_range(data, len);
 		}
 		return data;
 	});
@@ -234,12 +207,7 @@ void setup_native_memory_syscalls(Machine<W>& machine, bool trusted)
 				m.template sysargs<address_type<W>, address_type<W>, address_type<W>> ();
 			SYSPRINT("SYSCALL memcpy(%#X, %#X, %u)\n", dst, src, len);
 			m.cpu.increment_counter(2 * len);
-			m.memory.memview(src, len,
-				[&m] (const uint8_t* data, size_t len) {
-					auto dst = m.template sysarg <address_type<W>> (0);
-					m.memory.memcpy(dst, data, len);
-				});
-			return dst;
+			return machine_memcpy(m, dst, src, len);
 		});
 		// Memset n+6
 		machine.install_syscall_handler(NATIVE_SYSCALLS_BASE+6,
@@ -281,18 +249,7 @@ void setup_native_memory_syscalls(Machine<W>& machine, bool trusted)
 		auto [dst, src, len] = 
 			m.template sysargs<address_type<W>, address_type<W>, address_type<W>> ();
 		SYSPRINT("SYSCALL memmove(%#X, %#X, %u)\n", dst, src, len);
-		if (src < dst)
-		{
-			for (unsigned i = 0; i != len; i++) {
-				m.memory.template write<uint8_t> (dst + i, 
-					m.memory.template read<uint8_t> (src + i));
-			}
-		} else {
-			while (len-- != 0) {
-				m.memory.template write<uint8_t> (dst + len, 
-					m.memory.template read<uint8_t> (src + len));
-			}
-		}
+		m.memory.memmove_guest(dst, src, len);
 		m.cpu.increment_counter(2 * len);
 		return dst;
 	});
@@ -1,4 +1,5 @@
 #include <include/syscall_helpers.hpp>
+#include <climits>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -55,6 +56,9 @@ long syscall_write(Machine<W>& machine)
 	return -EBADF;
 }
 
+// the most bytes written by one writev
+static constexpr size_t WRITEV_MAX = 1ul << 20;
+
 template <int W>
 long syscall_writev(Machine<W>& machine)
 {
@@ -73,21 +77,42 @@ long syscall_writev(Machine<W>& machine)
         std::vector<guest_iovec<W>> vec(count);
         machine.memory.memcpy_out(vec.data(), iov_g, size);
 
-        int res = 0;
+#ifdef RISCV_DEBUG
+        // view the guest buffers directly, without copying
+        std::vector<struct iovec> buffers;
+#endif
+        // larger writes are cut short, like the kernel does
+        size_t res = 0;
         for (const auto& iov : vec)
         {
-			char buffer[1024];
+            if (iov.iov_len < 0) return -EINVAL;
             auto src_g = (address_type<W>) iov.iov_base;
-            auto len_g = std::min(sizeof(buffer), (size_t) iov.iov_len);
-            machine.memory.memcpy_out(buffer, src_g, len_g);
-			state->output += std::string(buffer, len_g);
+            const size_t len_g = std::min((size_t) iov.iov_len, WRITEV_MAX - res);
+            for (const auto& buf : machine.memory.gather_buffers_from_range(src_g, len_g)) {
+                state->output.append(buf.ptr, buf.len);
 #ifdef RISCV_DEBUG
-			res += write(fd, buffer, len_g);
-#else
-			res += len_g;
+                buffers.push_back({ (void*) buf.ptr, buf.len });
 #endif
+            }
+            res += len_g;
+            if (res == WRITEV_MAX) break;
         }
+#ifdef RISCV_DEBUG
+        // at most IOV_MAX buffers at a time
+        ssize_t written = 0;
+        for (size_t i = 0; i < buffers.size(); i += IOV_MAX) {
+            const size_t cnt = std::min<size_t>(IOV_MAX, buffers.size() - i);
+            size_t len = 0;
+            for (size_t j = i; j < i + cnt; j++) len += buffers[j].iov_len;
+            const ssize_t r = writev(fd, &buffers[i], cnt);
+            if (r < 0) return (written > 0) ? written : r;
+            written += r;
+            if ((size_t) r < len) break;
+        }
+        return written;
+#else
         return res;
+#endif
 	}
 	return -EBADF;
 }
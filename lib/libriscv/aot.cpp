@@ -0,0 +1,431 @@
+#include "aot.hpp"
+#include "machine.hpp"
+#include "decoder_cache.hpp"
+#include "threaded_bytecodes.hpp"
+#include "util/hash.hpp"
+#include <cstdarg>
+#include <dlfcn.h>
+#include <set>
+#include <stdexcept>
+
+namespace riscv
+{
+	template <int W, typename T>
+	static uint64_t aot_read(void* memory, address_type<W> addr)
+	{
+		return static_cast<Memory<W>*> (memory)->template read<T> (addr);
+	}
+	template <int W, typename T>
+	static void aot_write(void* memory, address_type<W> addr, uint64_t value)
+	{
+		static_cast<Memory<W>*> (memory)->template write<T> (addr, value);
+	}
+
+	template <int W>
+	const AOTCallbacks<W> AOT<W>::callbacks {
+		{ &aot_read<W, uint8_t>,  &aot_read<W, uint16_t>,
+		  &aot_read<W, uint32_t>, &aot_read<W, uint64_t> },
+		{ &aot_write<W, uint8_t>,  &aot_write<W, uint16_t>,
+		  &aot_write<W, uint32_t>, &aot_write<W, uint64_t> },
+	};
+
+	// must match AOTState and AOTCallbacks
+	static const char aot_preamble[] = R"(#include <cstdint>
+namespace rvaot {
+	using addr_t  = %s;
+	using saddr_t = %s;
+	struct Callbacks {
+		uint64_t (*read[4]) (void*, addr_t);
+		void (*write[4]) (void*, addr_t, uint64_t);
+	};
+	struct State {
+		addr_t*   regs;
+		addr_t*   pc;
+		uint64_t* counter;
+		uint64_t  max_counter;
+		void*     memory;
+		const Callbacks* api;
+	};
+	struct Block {
+		addr_t   addr;
+		uint32_t length;
+		void (*func) (State&);
+	};
+}
+using namespace rvaot;
+#define R(x)  s.regs[x]
+#define SR(x) ((saddr_t) s.regs[x])
+// keep PC and the counter exact before anything that can throw
+#define SYNC(addr, idx) *s.pc = addr; *s.counter = c + idx;
+#define EXIT(addr, idx) { *s.pc = addr; *s.counter = c + idx; return; }
+
+)";
+
+	namespace {
+	template <int W>
+	struct Translator
+	{
+		using address_t = address_type<W>;
+		static constexpr bool W64 = (W == 8);
+
+		const uint8_t* exec; // indexed by virtual address
+		const address_t begin;
+		const address_t end;
+		std::string code;
+		std::set<address_t> leaders;
+
+		void emit(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+		rv32i_instruction instr_at(address_t pc) const {
+			return rv32i_instruction { *(uint32_t*) &exec[pc] };
+		}
+		static bool aligned(address_t addr) {
+			return (addr & (compressed_enabled ? 0x1 : 0x3)) == 0;
+		}
+		void add_leader(address_t addr) {
+			if (addr >= begin && addr < end && aligned(addr))
+				leaders.insert(addr);
+		}
+
+		void find_leaders(address_t entry);
+		bool translate_block(address_t addr, uint32_t& length);
+		bool instr(rv32i_instruction, address_t pc, uint32_t idx,
+			address_t block, bool& terminal, bool& looped);
+		void jump(address_t target, uint32_t idx, address_t block, bool& looped);
+
+		Translator(const uint8_t* e, address_t b, address_t en)
+			: exec(e), begin(b), end(en) {}
+	};
+
+	template <int W>
+	void Translator<W>::emit(const char* fmt, ...)
+	{
+		va_list args;
+		va_start(args, fmt);
+		va_list copy;
+		va_copy(copy, args);
+		const int len = vsnprintf(nullptr, 0, fmt, copy);
+		va_end(copy);
+		const size_t pos = code.size();
+		code.resize(pos + len + 1);
+		vsnprintf(&code[pos], len + 1, fmt, args);
+		code.resize(pos + len);
+		va_end(args);
+	}
+
+	template <int W>
+	void Translator<W>::find_leaders(address_t entry)
+	{
+		add_leader(begin);
+		add_leader(entry);
+		for (address_t pc = begin; pc + 2 <= end; )
+		{
+			const rv32i_instruction instr { *(uint16_t*) &exec[pc] };
+			if (!instr.is_long()) {
+				pc += 2;
+				continue;
+			}
+			if (pc + 4 > end)
+				break;
+			const auto full = instr_at(pc);
+			switch (full.opcode()) {
+			case 0b1100011: // BRANCH
+				add_leader(pc + full.Btype.signed_imm());
+				add_leader(pc + 4);
+				break;
+			case 0b1101111: // JAL
+				add_leader(pc + full.Jtype.jump_offset());
+				add_leader(pc + 4);
+				break;
+			case 0b1100111: // JALR
+			case 0b1110011: // SYSTEM
+				add_leader(pc + 4);
+				break;
+			}
+			pc += 4;
+		}
+	}
+
+	template <int W>
+	void Translator<W>::jump(address_t target, uint32_t idx, address_t block, bool& looped)
+	{
+		if (target == block) {
+			// loop back to the start of the block while there is budget
+			// for a whole pass, as the next pass may not take this branch
+			looped = true;
+			emit("\t\tc += %u; if (c + length <= s.max_counter) goto top;\n"
+				"\t\tEXIT(0x%llx, 0);\n",
+				idx + 1, (unsigned long long) target);
+		} else {
+			emit("\t\tEXIT(0x%llx, %u);\n", (unsigned long long) target, idx + 1);
+		}
+	}
+
+	template <int W>
+	bool Translator<W>::instr(rv32i_instruction instr, address_t pc, uint32_t idx,
+		address_t block, bool& terminal, bool& looped)
+	{
+		if (!instr.is_long())
+			return false;
+		const auto PC = (unsigned long long) pc;
+		switch (instr.opcode()) {
+		case 0b0000011: { // LOAD
+			const char* cast;
+			int size;
+			switch (instr.Itype.funct3) {
+			case 0x0: size = 0; cast = "(addr_t) (saddr_t) (int8_t)"; break;
+			case 0x1: size = 1; cast = "(addr_t) (saddr_t) (int16_t)"; break;
+			case 0x2: size = 2; cast = "(addr_t) (saddr_t) (int32_t)"; break;
+			case 0x3: if (!W64) return false;
+				size = 3; cast = "(addr_t)"; break;
+			case 0x4: size = 0; cast = "(addr_t)"; break;
+			case 0x5: size = 1; cast = "(addr_t)"; break;
+			case 0x6: size = 2; cast = "(addr_t)"; break;
+			default: return false;
+			}
+			emit("\tSYNC(0x%llx, %u);\n", PC, idx);
+			if (instr.Itype.rd != 0)
+				emit("\tR(%u) = %s ", instr.Itype.rd, cast);
+			else
+				emit("\t");
+			emit("s.api->read[%d](s.memory, R(%u) + (addr_t) %lld);\n",
+				size, instr.Itype.rs1, (long long) instr.Itype.signed_imm());
+			return true;
+			}
+		case 0b0100011: // STORE
+			if (instr.Stype.funct3 > (W64 ? 0x3 : 0x2))
+				return false;
+			emit("\tSYNC(0x%llx, %u);\n", PC, idx);
+			emit("\ts.api->write[%u](s.memory, R(%u) + (addr_t) %lld, R(%u));\n",
+				instr.Stype.funct3, instr.Stype.rs1,
+				(long long) instr.Stype.signed_imm(), instr.Stype.rs2);
+			return true;
+		case 0b0010011: { // OP_IMM
+			if (instr.Itype.rd == 0)
+				return true;
+			const unsigned rd = instr.Itype.rd, rs1 = instr.Itype.rs1;
+			const long long imm = instr.Itype.signed_imm();
+			const unsigned shamt = (W64) ? instr.Itype.shift64_imm() : instr.Itype.shift_imm();
+			switch (instr.Itype.funct3) {
+			case 0x0: emit("\tR(%u) = R(%u) + (addr_t) %lld;\n", rd, rs1, imm); break;
+			case 0x1: emit("\tR(%u) = R(%u) << %u;\n", rd, rs1, shamt); break;
+			case 0x2: emit("\tR(%u) = SR(%u) < (saddr_t) %lld;\n", rd, rs1, imm); break;
+			case 0x3: emit("\tR(%u) = R(%u) < (addr_t) %lld;\n", rd, rs1, imm); break;
+			case 0x4: emit("\tR(%u) = R(%u) ^ (addr_t) %lld;\n", rd, rs1, imm); break;
+			case 0x5:
+				if (instr.Itype.is_srai())
+					emit("\tR(%u) = SR(%u) >> %u;\n", rd, rs1, shamt);
+				else
+					emit("\tR(%u) = R(%u) >> %u;\n", rd, rs1, shamt);
+				break;
+			case 0x6: emit("\tR(%u) = R(%u) | (addr_t) %lld;\n", rd, rs1, imm); break;
+			case 0x7: emit("\tR(%u) = R(%u) & (addr_t) %lld;\n", rd, rs1, imm); break;
+			}
+			return true;
+			}
+		case 0b0110011: { // OP
+			const uint32_t f7 = instr.Rtype.funct7;
+			const uint32_t f3 = instr.Rtype.funct3;
+			// base instructions, SUB, SRA and MUL
+			if (!(f7 == 0 || (f7 == 0x20 && (f3 == 0x0 || f3 == 0x5))
+				|| (f7 == 0x1 && f3 == 0x0)))
+				return false;
+			if (instr.Rtype.rd == 0)
+				return true;
+			const unsigned rd = instr.Rtype.rd;
+			const unsigned rs1 = instr.Rtype.rs1, rs2 = instr.Rtype.rs2;
+			const unsigned mask = W * 8 - 1;
+			switch (f3) {
+			case 0x0:
+				emit("\tR(%u) = R(%u) %c R(%u);\n", rd, rs1,
+					(f7 == 0x1) ? '*' : (f7 ? '-' : '+'), rs2);
+				break;
+			case 0x1: emit("\tR(%u) = R(%u) << (R(%u) & %u);\n", rd, rs1, rs2, mask); break;
+			case 0x2: emit("\tR(%u) = SR(%u) < SR(%u);\n", rd, rs1, rs2); break;
+			case 0x3: emit("\tR(%u) = R(%u) < R(%u);\n", rd, rs1, rs2); break;
+			case 0x4: emit("\tR(%u) = R(%u) ^ R(%u);\n", rd, rs1, rs2); break;
+			case 0x5:
+				emit("\tR(%u) = %sR(%u) >> (R(%u) & %u);\n",
+					rd, f7 ? "S" : "", rs1, rs2, mask);
+				break;
+			case 0x6: emit("\tR(%u) = R(%u) | R(%u);\n", rd, rs1, rs2); break;
+			case 0x7: emit("\tR(%u) = R(%u) & R(%u);\n", rd, rs1, rs2); break;
+			}
+			return true;
+			}
+		case 0b1100011: { // BRANCH
+			const char* cond;
+			switch (instr.Btype.funct3) {
+			case 0x0: cond = "R(%u) == R(%u)"; break;
+			case 0x1: cond = "R(%u) != R(%u)"; break;
+			case 0x4: cond = "SR(%u) < SR(%u)"; break;
+			case 0x5: cond = "SR(%u) >= SR(%u)"; break;
+			case 0x6: cond = "R(%u) < R(%u)"; break;
+			case 0x7: cond = "R(%u) >= R(%u)"; break;
+			default: return false;
+			}
+			const address_t target = pc + instr.Btype.signed_imm();
+			if (!aligned(target))
+				return false;
+			char test[64];
+			snprintf(test, sizeof(test), cond, instr.Btype.rs1, instr.Btype.rs2);
+			emit("\tif (%s) {\n", test);
+			this->jump(target, idx, block, looped);
+			emit("\t}\n");
+			return true;
+			}
+		case 0b0110111: // LUI
+			if (instr.Utype.rd != 0)
+				emit("\tR(%u) = (addr_t) 0x%llx;\n", instr.Utype.rd,
+					(unsigned long long) (address_t) (int32_t) instr.Utype.upper_imm());
+			return true;
+		case 0b0010111: // AUIPC
+			if (instr.Utype.rd != 0)
+				emit("\tR(%u) = (addr_t) 0x%llx;\n", instr.Utype.rd,
+					(unsigned long long) (address_t) (pc + instr.Utype.upper_imm()));
+			return true;
+		case 0b1101111: { // JAL
+			const address_t target = pc + instr.Jtype.jump_offset();
+			if (!aligned(target))
+				return false;
+			if (instr.Jtype.rd != 0)
+				emit("\tR(%u) = 0x%llx;\n", instr.Jtype.rd, PC + 4);
+			emit("\t{\n");
+			this->jump(target, idx, block, looped);
+			emit("\t}\n");
+			terminal = true;
+			return true;
+			}
+		case 0b1100111: // JALR
+			// misaligned jumps are left to the interpreter
+			emit("\t{\n\t\tconst addr_t target = R(%u) + (addr_t) %lld;\n"
+				"\t\tif (target & %u) EXIT(0x%llx, %u);\n",
+				instr.Itype.rs1, (long long) instr.Itype.signed_imm(),
+				compressed_enabled ? 0x1 : 0x3, PC, idx);
+			if (instr.Itype.rd != 0)
+				emit("\t\tR(%u) = 0x%llx;\n", instr.Itype.rd, PC + 4);
+			emit("\t\tEXIT(target, %u);\n\t}\n", idx + 1);
+			terminal = true;
+			return true;
+		}
+		return false;
+	}
+
+	template <int W>
+	bool Translator<W>::translate_block(address_t addr, uint32_t& length)
+	{
+		const size_t header = code.size();
+		bool terminal = false;
+		bool looped = false;
+		address_t pc = addr;
+		length = 0;
+		while (!terminal && length < AOT<W>::MAX_BLOCK_INSTRUCTIONS && pc + 4 <= end)
+		{
+			if (!instr(instr_at(pc), pc, length, addr, terminal, looped))
+				break;
+			pc += 4;
+			length ++;
+		}
+		if (length == 0) {
+			code.resize(header);
+			return false;
+		}
+		// fall through to the next instruction
+		if (!terminal)
+			emit("\tEXIT(0x%llx, %u);\n", (unsigned long long) pc, length);
+		emit("}\n");
+		const std::string body = code.substr(header);
+		code.resize(header);
+		emit("extern \"C\" void rvaot_%llx(State& s)\n{\n\tuint64_t c = *s.counter;\n",
+			(unsigned long long) addr);
+		if (looped)
+			emit("\tconst uint64_t length = %u;\ntop:\n", length);
+		code += body;
+		return true;
+	}
+	} // namespace
+
+	template <int W>
+	uint64_t AOT<W>::binary_hash(std::string_view binary)
+	{
+		return fnv1a_hash(binary);
+	}
+
+	template <int W>
+	std::string AOT<W>::translate(const Machine<W>& machine)
+	{
+		const auto& cpu = machine.cpu;
+		if (cpu.exec_seg_data() == nullptr)
+			throw std::runtime_error("Translation requires an execute segment");
+		Translator<W> tr { cpu.exec_seg_data(), cpu.exec_begin(), cpu.exec_end() };
+		tr.find_leaders(machine.memory.start_address());
+
+		tr.emit(aot_preamble, (W == 4) ? "uint32_t" : "uint64_t",
+			(W == 4) ? "int32_t" : "int64_t");
+		std::vector<std::pair<address_t, uint32_t>> blocks;
+		for (const address_t addr : tr.leaders) {
+			uint32_t length;
+			if (tr.translate_block(addr, length))
+				blocks.emplace_back(addr, length);
+		}
+
+		tr.emit("\nextern \"C\" const uint64_t riscv_aot_hash = 0x%llxull;\n",
+			(unsigned long long) binary_hash(machine.memory.binary()));
+		tr.emit("extern \"C\" const int riscv_aot_width = %d;\n", W);
+		tr.emit("extern \"C\" const uint32_t riscv_aot_count = %zu;\n", blocks.size());
+		tr.emit("extern \"C\" const Block riscv_aot_blocks[] = {\n");
+		for (const auto& block : blocks) {
+			tr.emit("\t{ 0x%llx, %u, rvaot_%llx },\n",
+				(unsigned long long) block.first, block.second,
+				(unsigned long long) block.first);
+		}
+		tr.emit("\t{ 0, 0, nullptr }\n};\n");
+		return std::move(tr.code);
+	}
+
+	template <int W>
+	AOT<W>::AOT(Memory<W>& memory, const std::string& path, address_t begin, address_t end)
+		: m_begin(begin), m_slots((end - begin) / DIVISOR + 1)
+	{
+		struct LoadedBlock {
+			address_t addr;
+			uint32_t  length;
+			block_func_t func;
+		};
+		this->m_dl = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (m_dl == nullptr)
+			throw std::runtime_error("Unable to load translation: " + path);
+
+		const auto* hash  = (const uint64_t*) dlsym(m_dl, "riscv_aot_hash");
+		const auto* width = (const int*) dlsym(m_dl, "riscv_aot_width");
+		const auto* count = (const uint32_t*) dlsym(m_dl, "riscv_aot_count");
+		const auto* table = (const LoadedBlock*) dlsym(m_dl, "riscv_aot_blocks");
+		if (!hash || !width || !count || !table) {
+			dlclose(m_dl);
+			throw std::runtime_error("Invalid translation: " + path);
+		}
+		// a stale translation is ignored, and everything is interpreted
+		if (*width != W || *hash != binary_hash(memory.binary()))
+			return;
+
+		auto* decoder = memory.get_decoder_cache();
+		for (uint32_t i = 0; i < *count; i++)
+		{
+			const auto& lb = table[i];
+			if (lb.addr < begin || lb.addr >= end || lb.addr % DIVISOR != 0)
+				continue;
+			auto& entry = decoder[lb.addr / DIVISOR];
+			m_slots[(lb.addr - begin) / DIVISOR] = m_blocks.size();
+			m_blocks.push_back(Block { lb.func, lb.length, entry.bytecode });
+			entry.bytecode = RV32I_BC_AOT;
+		}
+	}
+	template <int W>
+	AOT<W>::~AOT()
+	{
+		if (m_dl != nullptr)
+			dlclose(m_dl);
+	}
+
+	template struct AOT<4>;
+	template struct AOT<8>;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "common.hpp"
+#include "types.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace riscv
+{
+	template <int W> struct Machine;
+	template <int W> struct Memory;
+
+	// Memory accesses from translated code, indexed by log2 of the size
+	template <int W>
+	struct AOTCallbacks
+	{
+		using address_t = address_type<W>;
+		uint64_t (*read[4]) (void* memory, address_t addr);
+		void (*write[4]) (void* memory, address_t addr, uint64_t value);
+	};
+
+	// Passed to every translated block. The current PC and the counter
+	// are kept up to date before each memory access, so that exceptions
+	// can unwind through the translated code.
+	// NOTE: the layout is repeated in the generated sources
+	template <int W>
+	struct AOTState
+	{
+		using address_t = address_type<W>;
+		address_t* regs;
+		address_t* pc;
+		uint64_t*  counter;
+		uint64_t   max_counter;
+		void*      memory;
+		const AOTCallbacks<W>* api;
+	};
+
+	// Ahead-of-time translation of the execute segment into C++, with one
+	// function per basic block, compiled offline into a shared object.
+	// Blocks start at the segment start, the entry point, branch and jump
+	// targets and after every jump or system call, and run until the next
+	// jump or unsupported instruction. Compressed instructions end a block.
+	template <int W>
+	struct AOT
+	{
+		using address_t = address_type<W>;
+		using block_func_t = void (*)(AOTState<W>&);
+
+		struct Block {
+			block_func_t func = nullptr;
+			// number of instructions in one pass of the block
+			uint32_t length = 0;
+			// bytecode of the slot before it was replaced
+			uint8_t  bytecode = 0;
+		};
+		static constexpr uint32_t MAX_BLOCK_INSTRUCTIONS = 256;
+
+		// produce C++ source for the execute segment of @machine
+		static std::string translate(const Machine<W>&);
+		// identifies the binary that a translation was made for
+		static uint64_t binary_hash(std::string_view binary);
+
+		const Block& block(address_t pc) const noexcept {
+			return m_blocks[m_slots[(pc - m_begin) / DIVISOR]];
+		}
+		size_t loaded_blocks() const noexcept { return m_blocks.size(); }
+		static const AOTCallbacks<W> callbacks;
+
+		// load the shared object at @path, and replace the bytecodes of
+		// the decoder cache slots that have a translated block with
+		// RV32I_BC_AOT, unless it was made for a different binary
+		AOT(Memory<W>&, const std::string& path, address_t begin, address_t end);
+		~AOT();
+	private:
+		static constexpr size_t DIVISOR = (compressed_enabled) ? 2 : 4;
+
+		void* m_dl = nullptr;
+		const address_t m_begin;
+		// index into m_blocks for each slot
+		std::vector<uint32_t> m_slots;
+		std::vector<Block> m_blocks;
+	};
+}
@@ -22,6 +22,15 @@
 #define RISCV_SYSCALLS_MAX   512
 #endif
 
+// the largest Buffer argument to a system call (see Machine::sysarg)
+#ifndef RISCV_SYSCALL_BUFFER_MAX
+#define RISCV_SYSCALL_BUFFER_MAX  (16u << 20)
+#endif
+
+#ifndef RISCV_DATA_TLB_SIZE
+#define RISCV_DATA_TLB_SIZE  256
+#endif
+
 #ifdef RISCV_DEBUG
 # ifndef RISCV_MEMORY_TRAPS_ENABLED
 #   define RISCV_MEMORY_TRAPS_ENABLED
@@ -81,6 +90,7 @@ namespace riscv
 {
 	template <int W> struct Machine;
 	template <int W> struct Memory;
+	struct FusionTable;
 
 	template <int W>
 	struct MachineOptions
@@ -92,12 +102,41 @@ namespace riscv
 
 		// machine who owns all the execute- and read-only memory
 		const Machine<W>* owning_machine = nullptr;
+		// look up the pages of the owning machine on demand instead of
+		// copying its page table, which makes forking O(1). The owning
+		// machine must not change its pages while forks exist.
+		bool lazy_fork = false;
 		Function<struct Page&(Memory<W>&, size_t)> page_fault_handler = nullptr;
+		// back guest memory from the second page up to this address with
+		// one host mapping. Reads and writes there skip page attributes
+		// and traps, and machines using it can not be serialized. Forks
+		// share it copy-on-write. Zero disables it.
+		uint64_t linear_memory = 0;
+		// back the execute segment and linear memory with 2 MiB host
+		// pages where possible, for guests that use a lot of memory
+		bool use_hugepages = false;
+		// shared object made by the offline translator (RISCV_AOT),
+		// only used when it was made for the same binary
+		std::string translation = "";
+		// restricts the fused sequences in the decoder cache to the ones
+		// found by profiling (see sequence_profile.hpp), must outlive
+		// the machine. The default is to fuse every known sequence.
+		const FusionTable* fusion_table = nullptr;
 	};
 
 	template <int W>
 	struct SerializedMachine;
 
+	// what Machine::serialize_compact_to made of the pages
+	struct SnapshotStats {
+		size_t pages = 0;      // pages in the snapshot
+		size_t zero = 0;       // all-zero pages, stored without data
+		size_t binary = 0;     // pages identical to the ELF, stored as offsets
+		size_t duplicate = 0;  // pages identical to an earlier page
+		size_t compressed = 0; // pages stored compressed
+		size_t bytes = 0;      // size of the whole snapshot
+	};
+
 	template <class...> constexpr std::false_type always_false {};
 
 	template<typename T>
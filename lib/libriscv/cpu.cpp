@@ -4,6 +4,10 @@
 #include "riscvbase.hpp"
 #include "rv32i_instr.hpp"
 #include "rv64i_instr.hpp"
+#ifdef RISCV_DEBUG
+#include "sequence_profile.hpp"
+#include "threaded_bytecodes.hpp"
+#endif
 #ifdef __GNUG__
 #include "rv32i.cpp"
 #endif
@@ -25,6 +29,22 @@ namespace riscv
 		this->jump(machine().memory.start_address());
 	}
 
+	template <int W>
+	void CPU<W>::reset_from(const CPU& parent)
+	{
+		this->m_regs = parent.m_regs;
+		this->m_counter = parent.m_counter;
+#ifdef RISCV_EXT_ATOMICS
+		this->m_atomics = {};
+#endif
+#ifdef RISCV_PAGE_CACHE
+		for (auto& cache : this->m_page_cache)
+			cache.pageno = -1;
+#endif
+		this->m_current_page = {};
+		this->jump(this->pc());
+	}
+
 	template <int W>
 	typename CPU<W>::format_t CPU<W>::read_upper_half(address_t offset)
 	{
@@ -99,6 +119,10 @@ namespace riscv
 		const auto instruction = this->read_next_instruction();
 
 #ifdef RISCV_DEBUG
+		if (UNLIKELY(machine().sequence_profile != nullptr)) {
+			machine().sequence_profile->record(this->pc(),
+				threaded_bytecode_for<W> (instruction), instruction.is_long());
+		}
 		const auto& handler = this->decode(instruction);
 		// instruction logging
 		if (UNLIKELY(machine().verbose_instructions))
@@ -115,15 +139,20 @@ namespace riscv
 		// WARNING: the contract between read_next_instruction and this
 		// is that any jump traps must return to the caller, and be re-
 		// validated, otherwise this code will read garbage data!
-		auto& cache_entry =
-			machine().memory.get_decoder_cache()[this->pc() / DecoderCache<Page::SIZE>::DIVISOR];
+		if (LIKELY(this->pc() >= m_exec_begin && this->pc() < m_exec_end)) {
+			auto& cache_entry =
+				machine().memory.get_decoder_cache()[this->pc() / DecoderCache<Page::SIZE>::DIVISOR];
 #ifndef RISCV_INSTR_CACHE_PREGEN
-		if (UNLIKELY(!cache_entry)) {
-			cache_entry = this->decode(instruction).handler;
-		}
+			if (UNLIKELY(!cache_entry.handler)) {
+				cache_entry.handler = this->decode(instruction).handler;
+			}
 #endif
-		// execute instruction
-		cache_entry(*this, instruction);
+			// execute instruction
+			cache_entry.handler(*this, instruction);
+		} else {
+			// code outside of the execute segment has no decoder cache
+			this->execute(instruction);
+		}
 # else
 		// decode & execute instruction directly
 		this->execute(instruction);
@@ -150,6 +179,58 @@ namespace riscv
 			registers().pc += 4;
 	}
 
+#ifdef RISCV_BASIC_BLOCKS
+	template<int W>
+	void CPU<W>::simulate_block(const uint64_t max_counter)
+	{
+#ifndef RISCV_DEBUG
+		// pregenerated blocks only exist for the execute segment
+		if (LIKELY(this->pc() >= m_exec_begin && this->pc() < m_exec_end))
+		{
+			constexpr size_t DIVISOR = DecoderCache<Page::SIZE>::DIVISOR;
+			auto* entry =
+				&machine().memory.get_decoder_cache()[this->pc() / DIVISOR];
+			const unsigned count = entry->idxend;
+#ifdef RISCV_BATCHED_BUDGET
+			// the whole block runs as long as there is any budget left
+			if (LIKELY(m_counter < max_counter))
+#else
+			if (LIKELY(m_counter + count <= max_counter))
+#endif
+			{
+				// no instruction before the last can modify PC, so
+				// we can walk the decoder cache without any checks.
+				// The counter stays exact when a handler throws.
+				for (unsigned i = 1; i < count; i++) {
+					entry->handler(*this, entry->instr);
+					this->m_counter ++;
+					if constexpr (compressed_enabled) {
+						const unsigned length = entry->instr.length();
+						registers().pc += length;
+						entry += length / DIVISOR;
+					} else {
+						registers().pc += 4;
+						entry += 1;
+					}
+				}
+				// the last instruction may jump, invoke a system call
+				// or stop the machine
+				entry->handler(*this, entry->instr);
+				this->m_counter ++;
+				if constexpr (compressed_enabled)
+					registers().pc += entry->instr.length();
+				else
+					registers().pc += 4;
+				return;
+			}
+		}
+#else
+		(void) max_counter;
+#endif
+		this->simulate();
+	}
+#endif
+
 	template<int W> __attribute__((cold))
 	void CPU<W>::trigger_exception(interrupt_t intr, address_t data)
 	{
@@ -23,7 +23,21 @@ namespace riscv
 		using instruction_t = Instruction<W>;
 
 		void simulate();
+#ifdef RISCV_BASIC_BLOCKS
+		// Execute a whole basic block from the decoder cache, unless
+		// it would go past @max_counter, in which case only one
+		// instruction is executed.
+		void simulate_block(uint64_t max_counter);
+#endif
+#ifdef RISCV_THREADED_DISPATCH
+		// Execute from the decoder cache using computed gotos until the
+		// machine stops, @max_counter is reached or execution leaves
+		// the execute segment.
+		void simulate_threaded(uint64_t max_counter);
+#endif
 		void reset();
+		// takes the registers and counter from the machine forked from
+		void reset_from(const CPU& parent);
 		void reset_stack_pointer() noexcept;
 
 		address_t pc() const noexcept { return registers().pc; }
@@ -65,6 +79,8 @@ namespace riscv
 		void initialize_exec_segs(const uint8_t* data, address_t begin, address_t end)
 			{ m_exec_data = data; m_exec_begin = begin; m_exec_end = end; }
 		const uint8_t* exec_seg_data() const { return m_exec_data; }
+		address_t exec_begin() const noexcept { return m_exec_begin; }
+		address_t exec_end() const noexcept { return m_exec_end; }
 
 		// serializes all the machine state + a tiny header to @vec
 		void serialize_to(std::vector<uint8_t>& vec);
@@ -4,15 +4,58 @@
 #include <stdexcept>
 
 #include "rv32i_instr.hpp"
+#include "instr_helpers.hpp"
+#include "threaded_bytecodes.hpp"
+#include "sequence_profile.hpp"
+#ifdef RISCV_JIT
+#include "jit.hpp"
+#endif
+#ifdef RISCV_AOT
+#include "aot.hpp"
+#endif
 
 namespace riscv
 {
 
 #ifdef RISCV_INSTR_CACHE
+#ifdef RISCV_BASIC_BLOCKS
+	// Instructions that can modify PC, call into the system or stop
+	// the machine. They are always the last instruction in a block.
+	template <int W>
+	static bool is_block_terminator(rv32i_instruction instr)
+	{
+		if (instr.is_long()) {
+			switch (instr.opcode()) {
+			case 0b1100011: // BRANCH
+			case 0b1100111: // JALR
+			case 0b1101111: // JAL
+			case 0b1110011: // SYSTEM (ECALL, EBREAK, CSR)
+				return true;
+			}
+			return false;
+		}
+		if constexpr (compressed_enabled) {
+			const auto ci = instr.compressed();
+			switch (ci.opcode()) {
+			case CI_CODE(0b001, 0b01): // C.JAL (C.ADDIW on RV64)
+				return W == 4;
+			case CI_CODE(0b101, 0b01): // C.J
+			case CI_CODE(0b110, 0b01): // C.BEQZ
+			case CI_CODE(0b111, 0b01): // C.BNEZ
+				return true;
+			case CI_CODE(0b100, 0b10): // C.JR, C.JALR, C.EBREAK
+				return ci.CR.rs2 == 0;
+			}
+		}
+		return false;
+	}
+#endif
+
 	template <int W>
 	void Memory<W>::generate_decoder_cache(address_t addr, size_t len)
 	{
 		constexpr address_t PMASK = Page::size()-1;
+		constexpr size_t DIVISOR = DecoderCache<Page::SIZE>::DIVISOR;
 		const address_t pbase = addr & ~PMASK;
 		const size_t prelen  = addr - pbase;
 		const size_t midlen  = len + prelen;
@@ -22,59 +65,114 @@ namespace riscv
 		const size_t n_pages = plen / Page::size();
 		auto* decoder_array = new DecoderCache<Page::SIZE> [n_pages];
 		this->m_exec_decoder =
-			decoder_array[0].template get_base<W>() - pbase / DecoderCache<Page::SIZE>::DIVISOR;
+			decoder_array[0].template get_base<W>() - pbase / DIVISOR;
 		this->m_decoder_cache = &decoder_array[0];
-		size_t dcindex = 0;
-		while (len > 0)
-		{
-			const size_t size = std::min(Page::size(), len);
-			const size_t pageno = page_number(addr);
-			// find page itself
-			auto it = m_pages.find(pageno);
-			if (it != m_pages.end()) {
-				auto& page = it->second;
-				if (page.attr.exec) {
-					// assign slice
-					auto* cache = &decoder_array[dcindex];
-					dcindex++;
 #ifdef RISCV_INSTR_CACHE_PREGEN
-					// fill start with illegal instructions
-					const address_t start_offset = addr & (Page::size()-1);
-					for (address_t off = 0; off < start_offset; off += 4)
-					{
-						cache->template get<W> (off / cache->DIVISOR) =
-							machine().cpu.decode(rv32i_instruction{0}).handler;
-					}
-					// generate instruction handler pointers for machine code
-					for (address_t dst = addr; dst < addr + size;)
-					{
-						const address_t offset = dst & (Page::size()-1);
-						rv32i_instruction instruction;
-						instruction.whole = *(uint32_t*) (page.data() + offset);
-
-						cache->template get<W> (offset / cache->DIVISOR) =
-							machine().cpu.decode(instruction).handler;
+		// fill pages with illegal instructions
+		const auto& illegal = machine().cpu.decode(rv32i_instruction{0});
+		for (address_t dst = pbase; dst < pbase + plen; dst += DIVISOR)
+		{
+			m_exec_decoder[dst / DIVISOR].handler = illegal.handler;
+		}
+		// generate instruction handlers for every possible instruction
+		// address, as jumps can land in the middle of a 4-byte instruction
+		const uint8_t* exec_offset = m_exec_pagedata.get() - pbase;
+		const address_t addr_end = addr + len;
+		for (address_t dst = addr; dst < addr_end; dst += DIVISOR)
+		{
+			rv32i_instruction instruction;
+			if (LIKELY(dst + 4 <= pbase + plen)) {
+				instruction.whole = *(uint32_t*) &exec_offset[dst];
+			} else {
+				instruction.half[0] = *(uint16_t*) &exec_offset[dst];
+			}
 
-						dst += instruction.length();
-					}
-					// fill end with illegal instructions
-					const address_t end_offset = (addr + size) & (Page::size()-1);
-					if (end_offset != 0)
-					for (address_t off = end_offset; off < Page::size(); off += 4)
-					{
-						cache->template get<W> (off / cache->DIVISOR) =
-							machine().cpu.decode(rv32i_instruction{0}).handler;
-					}
-#else
-					// the instructions will be decoded on-demand
-					*cache = {};
+			auto& entry = m_exec_decoder[dst / DIVISOR];
+			entry.handler = machine().cpu.decode(instruction).handler;
+			entry.instr   = instruction;
+		}
+#ifdef RISCV_BASIC_BLOCKS
+		// calculate the remaining block length for each slot, backwards,
+		// so that any instruction address can be the start of a block
+		for (address_t dst = addr_end; dst > addr; )
+		{
+			dst -= DIVISOR;
+			auto& entry = m_exec_decoder[dst / DIVISOR];
+			const address_t next = dst + entry.instr.length();
+			if (is_block_terminator<W> (entry.instr) || next >= addr_end) {
+				entry.idxend = 1;
+			} else {
+				const unsigned idxend = 1 + m_exec_decoder[next / DIVISOR].idxend;
+				entry.idxend = std::min(idxend, 255u);
+			}
+		}
 #endif
-				}
+#ifdef RISCV_THREADED_DISPATCH
+		// select bytecodes and pre-decode their operands, which
+		// must happen last as the raw instruction bits are replaced
+		for (address_t dst = addr; dst < addr_end; dst += DIVISOR)
+		{
+			auto& entry = m_exec_decoder[dst / DIVISOR];
+			auto bytecode = threaded_bytecode_for<W> (entry.instr);
+			// taken branches and JAL go straight to the slot of their
+			// target, so it must be validated here instead
+			if (bytecode >= RV32I_BC_BEQ && bytecode <= RV32I_BC_JAL) {
+				const address_t target = dst + ((bytecode == RV32I_BC_JAL)
+					? entry.instr.Jtype.jump_offset() : entry.instr.Btype.signed_imm());
+				if (target < addr || target >= addr_end || target % DIVISOR != 0)
+					bytecode = RV32I_BC_FUNCTION;
+			}
+			entry.bytecode = bytecode;
+			entry.instr = threaded_rewrite(bytecode, entry.instr);
+		}
+		// fuse common sequences into one dispatch, going forwards so that
+		// the following slots are still unfused. They keep their own
+		// bytecodes, as they may also be jumped to directly.
+		for (address_t dst = addr; dst + 8 <= addr_end; dst += DIVISOR)
+		{
+			auto* entry = &m_exec_decoder[dst / DIVISOR];
+			if (entry->bytecode == RV32I_BC_FUNCTION)
+				continue;
+			std::array<threaded_bytecode, 3> sequence;
+			size_t count = 0;
+			for (; count < sequence.size() && dst + 4 * (count+1) <= addr_end; count++)
+			{
+				sequence[count] = (threaded_bytecode)
+					entry[count * 4 / DIVISOR].bytecode;
+			}
+			auto fused = threaded_fused_bytecode_for<W> (sequence.data(), count);
+			// with a profile, only fuse the sequences that it has seen
+			if (m_fusion_table != nullptr && fused != sequence[0] &&
+				!m_fusion_table->contains((const uint8_t*) sequence.data(),
+					threaded_bytecode_length(fused)))
+				fused = sequence[0];
+			entry->bytecode = fused;
+		}
+#endif
+#ifdef RISCV_AOT
+		// native blocks from the offline translation, if there is one
+		delete this->m_aot;
+		this->m_aot = nullptr;
+		if (!m_translation.empty()) {
+			auto* aot = new AOT<W> (*this, m_translation, addr, addr_end);
+			if (aot->loaded_blocks() > 0) {
+				this->m_aot = aot;
+			} else {
+				delete aot;
+			}
+			if (this->m_verbose_loader) {
+				printf("* Translation %s: %zu blocks\n", m_translation.c_str(),
+					(m_aot) ? m_aot->loaded_blocks() : 0);
 			}
-
-			addr += size;
-			len  -= size;
 		}
+#endif
+#ifdef RISCV_JIT
+		// hot blocks are compiled on demand by the dispatch loop
+		delete this->m_jit;
+		this->m_jit = new JIT<W> (addr, addr_end);
+#endif
+#endif
+		// without pregeneration the instructions will be decoded on-demand
 	}
 #endif
 
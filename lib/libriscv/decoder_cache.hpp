@@ -1,15 +1,32 @@
 #pragma once
 #include <array>
+#include "common.hpp"
 #include "types.hpp"
+#include "rv32i_instr.hpp"
 
 namespace riscv {
 
+template <int W>
+struct DecoderData
+{
+	using format_t = instruction_format<W>;
+
+	instruction_handler<W> handler = nullptr;
+	format_t instr;
+#ifdef RISCV_BASIC_BLOCKS
+	// number of instructions until the end of the basic block,
+	// including this one, when entering the block at this slot
+	uint8_t  idxend = 0;
+#endif
+#ifdef RISCV_THREADED_DISPATCH
+	// label index in the threaded dispatch loop
+	uint8_t  bytecode = 0;
+#endif
+};
+
 template <size_t PageSize>
 union DecoderCache
 {
-	template <int W>
-	using handler = instruction_handler<W>;
-
 	template <int W>
 	inline auto& get(size_t idx) noexcept {
 		if constexpr (W == 4) {
@@ -32,8 +49,10 @@ union DecoderCache
 	// compressed instructions, which are 16-bits
 	static constexpr size_t DIVISOR = (compressed_enabled) ? 2 : 4;
 
-	std::array<handler<4>, PageSize / DIVISOR> cache32 = {nullptr};
-	std::array<handler<8>, PageSize / DIVISOR> cache64;
+	DecoderCache() : cache32 {} {}
+
+	std::array<DecoderData<4>, PageSize / DIVISOR> cache32;
+	std::array<DecoderData<8>, PageSize / DIVISOR> cache64;
 };
 
 }
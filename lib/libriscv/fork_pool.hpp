@@ -0,0 +1,81 @@
+#pragma once
+#include "machine.hpp"
+#include <memory>
+#include <vector>
+
+namespace riscv
+{
+	// Keeps forks of a master machine ready to be handed out, so that
+	// a request does not have to wait for a fork to be created. The
+	// forks are lazy by default (MachineOptions::lazy_fork). The master
+	// must outlive the pool and not change while forks exist.
+	// NOTE: the pool is not thread-safe
+	template <int W>
+	struct ForkPool
+	{
+		using machine_ptr = std::unique_ptr<Machine<W>>;
+
+		ForkPool(const Machine<W>& master, size_t count,
+			MachineOptions<W> options = { .lazy_fork = true });
+
+		// a ready fork, or a new one when the pool is empty
+		machine_ptr acquire();
+		// give back a fork, which is reset to the master for reuse
+		void release(machine_ptr fork);
+		// create forks until @count are ready
+		void prewarm(size_t count);
+
+		size_t available() const noexcept { return m_forks.size(); }
+		size_t capacity() const noexcept { return m_capacity; }
+
+	private:
+		machine_ptr create() const;
+
+		const Machine<W>& m_master;
+		MachineOptions<W> m_options;
+		const size_t m_capacity;
+		std::vector<machine_ptr> m_forks;
+	};
+
+	template <int W>
+	inline ForkPool<W>::ForkPool(const Machine<W>& master, size_t count,
+		MachineOptions<W> options)
+		: m_master{master}, m_options{std::move(options)}, m_capacity{count}
+	{
+		m_options.owning_machine = &master;
+		m_forks.reserve(count);
+		this->prewarm(count);
+	}
+
+	template <int W>
+	inline typename ForkPool<W>::machine_ptr ForkPool<W>::create() const
+	{
+		return std::make_unique<Machine<W>> (m_master.memory.binary(), m_options);
+	}
+
+	template <int W>
+	inline typename ForkPool<W>::machine_ptr ForkPool<W>::acquire()
+	{
+		if (m_forks.empty())
+			return create();
+		auto fork = std::move(m_forks.back());
+		m_forks.pop_back();
+		return fork;
+	}
+
+	template <int W>
+	inline void ForkPool<W>::release(machine_ptr fork)
+	{
+		if (m_forks.size() < m_capacity) {
+			fork->reset_to_parent();
+			m_forks.push_back(std::move(fork));
+		}
+	}
+
+	template <int W>
+	inline void ForkPool<W>::prewarm(size_t count)
+	{
+		while (m_forks.size() < count)
+			m_forks.push_back(create());
+	}
+}
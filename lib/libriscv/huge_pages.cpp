@@ -0,0 +1,43 @@
+#include "huge_pages.hpp"
+#include "types.hpp"
+#include <sys/mman.h>
+
+namespace riscv
+{
+	void* HugePages::allocate(size_t size)
+	{
+		const size_t len = round_up(size);
+#ifdef MAP_HUGETLB
+		void* area = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (area != MAP_FAILED)
+			return area;
+#endif
+		// over-allocate to be able to align the mapping
+		auto* raw = (uint8_t*) mmap(nullptr, len + SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED)
+			throw MachineException(OUT_OF_MEMORY, "Unable to allocate huge pages", size);
+		auto* data = (uint8_t*) (((uintptr_t) raw + SIZE - 1) & ~(SIZE - 1));
+		if (data != raw)
+			munmap(raw, data - raw);
+		if (const size_t tail = raw + SIZE - data; tail != 0)
+			munmap(data + len, tail);
+		advise(data, len);
+		return data;
+	}
+
+	void HugePages::deallocate(void* area, size_t size) noexcept
+	{
+		munmap(area, round_up(size));
+	}
+
+	void HugePages::advise(void* area, size_t size) noexcept
+	{
+#ifdef MADV_HUGEPAGE
+		madvise(area, size, MADV_HUGEPAGE);
+#else
+		(void) area; (void) size;
+#endif
+	}
+}
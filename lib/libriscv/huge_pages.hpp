@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace riscv
+{
+	// Host memory backed by 2 MiB pages (MachineOptions::use_hugepages),
+	// which cuts down on host TLB misses for large guests.
+	struct HugePages
+	{
+		static constexpr size_t SIZE = 2ull << 20;
+		static size_t round_up(size_t size) noexcept {
+			return (size + SIZE - 1) & ~(SIZE - 1);
+		}
+		// map @size bytes aligned to a huge page, with MAP_HUGETLB when
+		// the host has reserved huge pages, and transparent ones otherwise
+		static void* allocate(size_t size);
+		static void  deallocate(void* area, size_t size) noexcept;
+		// ask for transparent huge pages in an existing mapping
+		static void  advise(void* area, size_t size) noexcept;
+	};
+
+	// frees memory from either new[] or HugePages::allocate
+	struct HugePageDeleter
+	{
+		size_t size = 0; // zero when allocated with new[]
+		void operator() (uint8_t* data) const noexcept {
+			if (size != 0) HugePages::deallocate(data, size);
+			else delete[] data;
+		}
+	};
+}
@@ -0,0 +1,469 @@
+#include "jit.hpp"
+#include "machine.hpp"
+#include "decoder_cache.hpp"
+#include "threaded_bytecodes.hpp"
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <sys/mman.h>
+
+namespace riscv
+{
+	static_assert(std::is_standard_layout_v<JITContext<4>>
+		&& std::is_standard_layout_v<JITContext<8>>
+		&& offsetof(JITContext<4>, faulted) == 0
+		&& offsetof(JITContext<8>, faulted) == 0,
+		"Compiled code expects the fault flag at offset 0");
+
+	// x86-64 registers used by the code generator
+	// RBX: guest registers, R12: context, R13: executed, R14: budget
+	enum : uint8_t {
+		RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4,
+		RSI = 6, RDI = 7, R12 = 12, R13 = 13, R14 = 14
+	};
+	// x86 condition codes
+	enum : uint8_t {
+		CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+		CC_L = 0xC, CC_GE = 0xD
+	};
+
+	struct Emitter
+	{
+		std::vector<uint8_t> code;
+
+		void u8(uint8_t v) { code.push_back(v); }
+		void u32(uint32_t v) { for (int i = 0; i < 4; i++) u8(v >> (i * 8)); }
+		void u64(uint64_t v) { u32(v); u32(v >> 32); }
+		void rex(bool w, uint8_t reg, uint8_t rm) {
+			const uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+			if (r != 0x40) u8(r);
+		}
+		// register-direct operand
+		void direct(uint8_t reg, uint8_t rm) {
+			u8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+		}
+		// [base + disp32] operand
+		void mem(uint8_t reg, uint8_t base, int32_t disp) {
+			u8(0x80 | ((reg & 7) << 3) | (base & 7));
+			if ((base & 7) == RSP) u8(0x24);
+			u32(disp);
+		}
+		// forward jumps, returns the position to patch
+		size_t jcc(uint8_t cc) { u8(0x0F); u8(0x80 | cc); u32(0); return code.size(); }
+		void jcc_to(uint8_t cc, size_t target) {
+			const size_t pos = jcc(cc);
+			patch(pos, target);
+		}
+		void patch(size_t pos, size_t target) {
+			const int32_t rel = target - pos;
+			std::memcpy(&code[pos - 4], &rel, 4);
+		}
+	};
+
+	template <int W, typename T>
+	static uint64_t jit_read(JITContext<W>* ctx, address_type<W> addr)
+	{
+		try {
+			return ctx->memory->template read<T> (addr);
+		} catch (...) {
+			ctx->faulted = 1;
+			ctx->exception = std::current_exception();
+			return 0;
+		}
+	}
+	template <int W, typename T>
+	static void jit_write(JITContext<W>* ctx, address_type<W> addr, uint64_t value)
+	{
+		try {
+			ctx->memory->template write<T> (addr, value);
+		} catch (...) {
+			ctx->faulted = 1;
+			ctx->exception = std::current_exception();
+		}
+	}
+
+	template <int W>
+	struct Compiler
+	{
+		using address_t = address_type<W>;
+		static constexpr bool W64 = (W == 8);
+
+		Emitter e;
+		const uint8_t* exec_offset;
+		const address_t begin;
+		const address_t end;
+		const int32_t pcoff;
+		size_t   loop_start = 0;
+		uint32_t length = 0;
+		// loop checks need the final block length
+		std::vector<size_t> length_fixups;
+
+		static int32_t regoff(unsigned reg) { return reg * W; }
+
+		void load_reg(uint8_t dst, unsigned reg) {
+			e.rex(W64, dst, RBX); e.u8(0x8B); e.mem(dst, RBX, regoff(reg));
+		}
+		void store_reg(unsigned reg, uint8_t src) {
+			e.rex(W64, src, RBX); e.u8(0x89); e.mem(src, RBX, regoff(reg));
+		}
+		// store a constant to a guest register or to PC
+		void store_const(int32_t disp, address_t value) {
+			if (W64 && (int64_t) (int32_t) value != (int64_t) value) {
+				e.u8(0x48); e.u8(0xB8); e.u64(value); // mov rax, imm64
+				e.rex(W64, RAX, RBX); e.u8(0x89); e.mem(RAX, RBX, disp);
+			} else {
+				e.rex(W64, 0, RBX); e.u8(0xC7); e.mem(0, RBX, disp); e.u32(value);
+			}
+		}
+		// op rax, imm32 (sign-extended)
+		void alu_imm(uint8_t ext, int32_t imm) {
+			e.rex(W64, 0, RAX); e.u8(0x81); e.direct(ext, RAX); e.u32(imm);
+		}
+		// op rax, rcx
+		void alu_reg(uint8_t opcode) {
+			e.rex(W64, RCX, RAX); e.u8(opcode); e.direct(RCX, RAX);
+		}
+		// rax = (condition) ? 1 : 0
+		void setcc(uint8_t cc) {
+			e.u8(0x0F); e.u8(0x90 | cc); e.direct(0, RAX);
+			e.u8(0x0F); e.u8(0xB6); e.direct(RAX, RAX);
+		}
+		void epilogue() {
+			e.u8(0x48); e.u8(0x83); e.u8(0xC4); e.u8(0x08); // add rsp, 8
+			e.u8(0x41); e.u8(0x5E); // pop r14
+			e.u8(0x41); e.u8(0x5D); // pop r13
+			e.u8(0x41); e.u8(0x5C); // pop r12
+			e.u8(0x5B);             // pop rbx
+			e.u8(0xC3);             // ret
+		}
+		// leave the block with PC = @pc after @count more instructions
+		void exit(address_t pc, uint32_t count) {
+			store_const(pcoff, pc);
+			// lea rax, [r13 + count]
+			e.rex(true, RAX, R13); e.u8(0x8D); e.mem(RAX, R13, count);
+			epilogue();
+		}
+		// taken branch or jump from instruction @idx
+		void jump(address_t target, uint32_t idx) {
+			if (target == begin) {
+				// loop back while there is budget for another pass
+				e.rex(true, 0, R13); e.u8(0x81); e.direct(0, R13); e.u32(idx + 1);
+				e.u8(0x4C); e.u8(0x89); e.u8(0xF0); // mov rax, r14
+				e.u8(0x4C); e.u8(0x29); e.u8(0xE8); // sub rax, r13
+				e.u8(0x48); e.u8(0x3D); e.u32(0);   // cmp rax, length
+				length_fixups.push_back(e.code.size() - 4);
+				e.jcc_to(CC_AE, loop_start);
+				exit(target, 0);
+			} else {
+				exit(target, idx + 1);
+			}
+		}
+		// call a memory helper, with a fault check
+		void call_helper(void* func, address_t pc, uint32_t idx) {
+			e.u8(0x4C); e.u8(0x89); e.u8(0xE7); // mov rdi, r12
+			e.u8(0x48); e.u8(0xB8); e.u64((uintptr_t) func); // mov rax, func
+			e.u8(0xFF); e.u8(0xD0);             // call rax
+			// cmp byte [r12], 0
+			e.u8(0x41); e.u8(0x80); e.u8(0x3C); e.u8(0x24); e.u8(0x00);
+			const size_t ok = e.jcc(CC_E);
+			// the faulting instruction has not been executed
+			exit(pc, idx);
+			e.patch(ok, e.code.size());
+		}
+		// rsi = rs1 + imm
+		void address(unsigned rs1, int32_t imm) {
+			load_reg(RSI, rs1);
+			e.rex(W64, 0, RSI); e.u8(0x81); e.direct(0, RSI); e.u32(imm);
+		}
+		bool aligned(address_t target) const {
+			return (target & (compressed_enabled ? 0x1 : 0x3)) == 0;
+		}
+
+		bool emit_load(rv32i_instruction instr, address_t pc, uint32_t idx);
+		bool emit_store(rv32i_instruction instr, address_t pc, uint32_t idx);
+		bool emit_op_imm(rv32i_instruction instr);
+		bool emit_op(rv32i_instruction instr);
+		bool emit_branch(rv32i_instruction instr, address_t pc, uint32_t idx);
+		// returns false when the instruction ends the block
+		// before it, true otherwise, and sets @terminal on jumps
+		bool emit(rv32i_instruction instr, address_t pc, uint32_t idx, bool& terminal);
+
+		void compile();
+
+		Compiler(const uint8_t* exec, address_t b, address_t e, int32_t po)
+			: exec_offset(exec), begin(b), end(e), pcoff(po) {}
+	};
+
+	template <int W>
+	bool Compiler<W>::emit_load(rv32i_instruction instr, address_t pc, uint32_t idx)
+	{
+		void* func = nullptr;
+		switch (instr.Itype.funct3) {
+		case 0x0: case 0x4: func = (void*) &jit_read<W, uint8_t>; break;
+		case 0x1: case 0x5: func = (void*) &jit_read<W, uint16_t>; break;
+		case 0x2: case 0x6: func = (void*) &jit_read<W, uint32_t>; break;
+		case 0x3: if (W64) { func = (void*) &jit_read<W, uint64_t>; break; }
+			return false;
+		default: return false;
+		}
+		address(instr.Itype.rs1, instr.Itype.signed_imm());
+		call_helper(func, pc, idx);
+		if (instr.Itype.rd == 0)
+			return true;
+		switch (instr.Itype.funct3) {
+		case 0x0: // movsx rax, al
+			e.rex(W64, RAX, RAX); e.u8(0x0F); e.u8(0xBE); e.direct(RAX, RAX); break;
+		case 0x1: // movsx rax, ax
+			e.rex(W64, RAX, RAX); e.u8(0x0F); e.u8(0xBF); e.direct(RAX, RAX); break;
+		case 0x2: // movsxd rax, eax
+			if (W64) { e.u8(0x48); e.u8(0x63); e.direct(RAX, RAX); }
+			break;
+		}
+		store_reg(instr.Itype.rd, RAX);
+		return true;
+	}
+
+	template <int W>
+	bool Compiler<W>::emit_store(rv32i_instruction instr, address_t pc, uint32_t idx)
+	{
+		void* func = nullptr;
+		switch (instr.Stype.funct3) {
+		case 0x0: func = (void*) &jit_write<W, uint8_t>; break;
+		case 0x1: func = (void*) &jit_write<W, uint16_t>; break;
+		case 0x2: func = (void*) &jit_write<W, uint32_t>; break;
+		case 0x3: if (W64) { func = (void*) &jit_write<W, uint64_t>; break; }
+			return false;
+		default: return false;
+		}
+		address(instr.Stype.rs1, instr.Stype.signed_imm());
+		load_reg(RDX, instr.Stype.rs2);
+		call_helper(func, pc, idx);
+		return true;
+	}
+
+	template <int W>
+	bool Compiler<W>::emit_op_imm(rv32i_instruction instr)
+	{
+		const int32_t imm = instr.Itype.signed_imm();
+		const uint8_t shamt = (W64) ? instr.Itype.shift64_imm() : instr.Itype.shift_imm();
+		if (instr.Itype.rd == 0)
+			return true;
+		load_reg(RAX, instr.Itype.rs1);
+		switch (instr.Itype.funct3) {
+		case 0x0: alu_imm(0, imm); break; // ADDI
+		case 0x1: // SLLI
+			e.rex(W64, 0, RAX); e.u8(0xC1); e.direct(4, RAX); e.u8(shamt); break;
+		case 0x2: alu_imm(7, imm); setcc(CC_L); break; // SLTI
+		case 0x3: alu_imm(7, imm); setcc(CC_B); break; // SLTIU
+		case 0x4: alu_imm(6, imm); break; // XORI
+		case 0x5: // SRLI / SRAI
+			e.rex(W64, 0, RAX); e.u8(0xC1);
+			e.direct(instr.Itype.is_srai() ? 7 : 5, RAX); e.u8(shamt); break;
+		case 0x6: alu_imm(1, imm); break; // ORI
+		case 0x7: alu_imm(4, imm); break; // ANDI
+		}
+		store_reg(instr.Itype.rd, RAX);
+		return true;
+	}
+
+	template <int W>
+	bool Compiler<W>::emit_op(rv32i_instruction instr)
+	{
+		const uint32_t f7 = instr.Rtype.funct7;
+		const uint32_t f3 = instr.Rtype.funct3;
+		// base instructions, SUB, SRA and MUL
+		if (!(f7 == 0 || (f7 == 0x20 && (f3 == 0x0 || f3 == 0x5))
+			|| (f7 == 0x1 && f3 == 0x0)))
+			return false;
+		if (instr.Rtype.rd == 0)
+			return true;
+		load_reg(RAX, instr.Rtype.rs1);
+		load_reg(RCX, instr.Rtype.rs2);
+		switch (f3) {
+		case 0x0:
+			if (f7 == 0x1) { // imul rax, rcx
+				e.rex(W64, RAX, RCX); e.u8(0x0F); e.u8(0xAF); e.direct(RAX, RCX);
+			} else {
+				alu_reg(f7 ? 0x29 : 0x01); // SUB : ADD
+			}
+			break;
+		case 0x1: // SLL: shl rax, cl
+			e.rex(W64, 0, RAX); e.u8(0xD3); e.direct(4, RAX); break;
+		case 0x2: alu_reg(0x39); setcc(CC_L); break; // SLT
+		case 0x3: alu_reg(0x39); setcc(CC_B); break; // SLTU
+		case 0x4: alu_reg(0x31); break; // XOR
+		case 0x5: // SRL / SRA
+			e.rex(W64, 0, RAX); e.u8(0xD3); e.direct(f7 ? 7 : 5, RAX); break;
+		case 0x6: alu_reg(0x09); break; // OR
+		case 0x7: alu_reg(0x21); break; // AND
+		}
+		store_reg(instr.Rtype.rd, RAX);
+		return true;
+	}
+
+	template <int W>
+	bool Compiler<W>::emit_branch(rv32i_instruction instr, address_t pc, uint32_t idx)
+	{
+		// the condition is inverted to skip over the taken path
+		uint8_t not_taken;
+		switch (instr.Btype.funct3) {
+		case 0x0: not_taken = CC_NE; break; // BEQ
+		case 0x1: not_taken = CC_E;  break; // BNE
+		case 0x4: not_taken = CC_GE; break; // BLT
+		case 0x5: not_taken = CC_L;  break; // BGE
+		case 0x6: not_taken = CC_AE; break; // BLTU
+		case 0x7: not_taken = CC_B;  break; // BGEU
+		default: return false;
+		}
+		const address_t target = pc + instr.Btype.signed_imm();
+		if (!aligned(target))
+			return false;
+		load_reg(RAX, instr.Btype.rs1);
+		load_reg(RCX, instr.Btype.rs2);
+		alu_reg(0x39); // cmp rax, rcx
+		const size_t skip = e.jcc(not_taken);
+		jump(target, idx);
+		e.patch(skip, e.code.size());
+		return true;
+	}
+
+	template <int W>
+	bool Compiler<W>::emit(rv32i_instruction instr, address_t pc, uint32_t idx, bool& terminal)
+	{
+		if (!instr.is_long())
+			return false;
+		switch (instr.opcode()) {
+		case 0b0000011: // LOAD
+			return emit_load(instr, pc, idx);
+		case 0b0100011: // STORE
+			return emit_store(instr, pc, idx);
+		case 0b0010011: // OP_IMM
+			return emit_op_imm(instr);
+		case 0b0110011: // OP
+			return emit_op(instr);
+		case 0b1100011: // BRANCH
+			return emit_branch(instr, pc, idx);
+		case 0b0110111: // LUI
+			if (instr.Utype.rd != 0)
+				store_const(regoff(instr.Utype.rd), (int32_t) instr.Utype.upper_imm());
+			return true;
+		case 0b0010111: // AUIPC
+			if (instr.Utype.rd != 0)
+				store_const(regoff(instr.Utype.rd), pc + instr.Utype.upper_imm());
+			return true;
+		case 0b1101111: { // JAL
+			const address_t target = pc + instr.Jtype.jump_offset();
+			if (!aligned(target))
+				return false;
+			if (instr.Jtype.rd != 0)
+				store_const(regoff(instr.Jtype.rd), pc + 4);
+			jump(target, idx);
+			terminal = true;
+			return true;
+			}
+		case 0b1100111: { // JALR
+			load_reg(RAX, instr.Itype.rs1);
+			alu_imm(0, instr.Itype.signed_imm());
+			// misaligned jumps are left to the interpreter
+			e.u8(0xA8); e.u8(compressed_enabled ? 0x1 : 0x3); // test al, mask
+			const size_t ok = e.jcc(CC_E);
+			exit(pc, idx);
+			e.patch(ok, e.code.size());
+			if (instr.Itype.rd != 0)
+				store_const(regoff(instr.Itype.rd), pc + 4);
+			e.rex(W64, RAX, RBX); e.u8(0x89); e.mem(RAX, RBX, pcoff);
+			e.rex(true, RAX, R13); e.u8(0x8D); e.mem(RAX, R13, idx + 1);
+			epilogue();
+			terminal = true;
+			return true;
+			}
+		}
+		return false;
+	}
+
+	template <int W>
+	void Compiler<W>::compile()
+	{
+		e.u8(0x53);             // push rbx
+		e.u8(0x41); e.u8(0x54); // push r12
+		e.u8(0x41); e.u8(0x55); // push r13
+		e.u8(0x41); e.u8(0x56); // push r14
+		e.u8(0x48); e.u8(0x83); e.u8(0xEC); e.u8(0x08); // sub rsp, 8
+		e.u8(0x48); e.u8(0x89); e.u8(0xFB); // mov rbx, rdi
+		e.u8(0x49); e.u8(0x89); e.u8(0xF4); // mov r12, rsi
+		e.u8(0x49); e.u8(0x89); e.u8(0xD6); // mov r14, rdx
+		e.u8(0x45); e.u8(0x31); e.u8(0xED); // xor r13d, r13d
+		this->loop_start = e.code.size();
+
+		address_t pc = begin;
+		bool terminal = false;
+		while (!terminal && length < JIT<W>::MAX_BLOCK_INSTRUCTIONS && pc + 4 <= end)
+		{
+			const rv32i_instruction instr { *(uint32_t*) &exec_offset[pc] };
+			if (!emit(instr, pc, length, terminal))
+				break;
+			pc += 4;
+			length ++;
+		}
+		// fall through to the next instruction
+		if (!terminal && length > 0)
+			exit(pc, length);
+		for (const size_t pos : length_fixups)
+			std::memcpy(&e.code[pos], &length, 4);
+	}
+
+	template <int W>
+	void JIT<W>::compile(CPU<W>& cpu, address_t pc, DecoderData<W>& entry)
+	{
+		auto& state = m_slots[(pc - m_begin) / DIVISOR];
+		state = FAILED;
+		// already translated ahead of time
+		if (entry.bytecode == RV32I_BC_AOT || m_count == MAX_BLOCKS)
+			return;
+
+		auto& regs = cpu.registers();
+		const int32_t pcoff =
+			(const uint8_t*) &regs.pc - (const uint8_t*) &regs.get(0);
+		Compiler<W> comp { cpu.exec_seg_data(), pc, m_end, pcoff };
+		comp.compile();
+		if (comp.length == 0)
+			return;
+
+		const size_t size = comp.e.code.size();
+		void* code = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (code == MAP_FAILED)
+			return;
+		std::memcpy(code, comp.e.code.data(), size);
+		if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+			munmap(code, size);
+			return;
+		}
+		m_mappings.emplace_back(code, size);
+
+		// publish the block before the bytecode that leads to it, as
+		// forks on other threads run from the same decoder cache
+		m_blocks[m_count] = Block {
+			(block_func_t) code, comp.length, entry.bytecode
+		};
+		__atomic_store_n(&state, COMPILED | m_count, __ATOMIC_RELEASE);
+		__atomic_store_n(&entry.bytecode, (uint8_t) RV32I_BC_JIT, __ATOMIC_RELEASE);
+		m_count ++;
+	}
+
+	template <int W>
+	JIT<W>::JIT(address_t begin, address_t end)
+		: m_begin(begin), m_end(end), m_slots((end - begin) / DIVISOR + 1),
+		  m_blocks(MAX_BLOCKS)
+	{
+	}
+	template <int W>
+	JIT<W>::~JIT()
+	{
+		for (auto& mapping : m_mappings)
+			munmap(mapping.first, mapping.second);
+	}
+
+	template struct JIT<4>;
+	template struct JIT<8>;
+}
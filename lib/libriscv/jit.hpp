@@ -0,0 +1,89 @@
+#pragma once
+#include "common.hpp"
+#include "types.hpp"
+#include <exception>
+#include <vector>
+
+namespace riscv
+{
+	template <int W> struct CPU;
+	template <int W> struct Memory;
+	template <int W> struct DecoderData;
+
+	// Passed to compiled blocks. Memory accesses are done by calling
+	// back into Memory<W>, and any exception is stored here instead of
+	// unwinding through the generated code.
+	template <int W>
+	struct JITContext
+	{
+		// checked by compiled code after each memory access
+		// NOTE: must be the first member
+		uint8_t faulted = 0;
+		Memory<W>* memory;
+		std::exception_ptr exception = nullptr;
+
+		JITContext(Memory<W>& mem) : memory { &mem } {}
+	};
+
+	// Simple x86-64 template JIT for hot blocks in the execute segment.
+	// Blocks start at jump targets, and run straight-line until a jump,
+	// an unsupported instruction or the block size limit. Taken branches
+	// leave the block, except for loops back to the start of the block.
+	template <int W>
+	struct JIT
+	{
+		using address_t = address_type<W>;
+		// returns the number of instructions executed, and leaves
+		// the next PC in the register file
+		using block_func_t =
+			uint64_t (*)(void* regs, JITContext<W>* ctx, uint64_t budget);
+
+		struct Block {
+			block_func_t func = nullptr;
+			// maximum number of instructions in one pass of the block
+			uint32_t length = 0;
+			// bytecode of the slot before it was compiled
+			uint8_t  bytecode = 0;
+		};
+		static constexpr uint32_t HOT_THRESHOLD = 1000;
+		static constexpr uint32_t MAX_BLOCK_INSTRUCTIONS = 128;
+		// the blocks are allocated up front, so they never move
+		static constexpr uint32_t MAX_BLOCKS = 4096;
+
+		// count jumps to @pc, returns true once when it becomes hot
+		bool hot(address_t pc) noexcept {
+			auto& state = m_slots[(pc - m_begin) / DIVISOR];
+			if (LIKELY(state >= HOT_THRESHOLD))
+				return false;
+			return ++state == HOT_THRESHOLD;
+		}
+		// compile the block at @pc, and on success replace the
+		// bytecode of its decoder cache slot with RV32I_BC_JIT.
+		// Only the machine that owns the decoder cache compiles, while
+		// its forks may run the compiled blocks on other threads.
+		void compile(CPU<W>&, address_t pc, DecoderData<W>& entry);
+
+		const Block& block(address_t pc) const noexcept {
+			const uint32_t state =
+				__atomic_load_n(&m_slots[(pc - m_begin) / DIVISOR], __ATOMIC_ACQUIRE);
+			return m_blocks[state & ~COMPILED];
+		}
+		size_t compiled_blocks() const noexcept { return m_count; }
+
+		JIT(address_t begin, address_t end);
+		~JIT();
+	private:
+		static constexpr size_t   DIVISOR  = (compressed_enabled) ? 2 : 4;
+		static constexpr uint32_t FAILED   = HOT_THRESHOLD + 1;
+		static constexpr uint32_t COMPILED = 0x80000000;
+
+		const address_t m_begin;
+		const address_t m_end;
+		// jump counter for each slot, until it is either
+		// FAILED or COMPILED with an index into m_blocks
+		std::vector<uint32_t> m_slots;
+		std::vector<Block> m_blocks;
+		uint32_t m_count = 0;
+		std::vector<std::pair<void*, size_t>> m_mappings;
+	};
+}
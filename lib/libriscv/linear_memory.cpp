@@ -0,0 +1,91 @@
+#include "linear_memory.hpp"
+#include "huge_pages.hpp"
+#include "page.hpp"
+#include "types.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace riscv
+{
+	static constexpr size_t GUARD_SIZE = Page::size();
+
+	uint8_t* LinearMemory::reserve(size_t size)
+	{
+		// the whole range starts out inaccessible, including the guards
+		const size_t total = size + 2 * GUARD_SIZE;
+		const size_t extra = m_hugepages ? HugePages::SIZE : 0;
+		auto* area = (uint8_t*) mmap(nullptr, total + extra, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (area == MAP_FAILED)
+			throw MachineException(OUT_OF_MEMORY, "Unable to reserve linear memory", size);
+		if (m_hugepages) {
+			// huge pages need the memory aligned like the file offsets
+			auto* data = (uint8_t*) (((uintptr_t) area + GUARD_SIZE + extra - 1) & ~(extra - 1));
+			if (data - GUARD_SIZE != area)
+				munmap(area, data - GUARD_SIZE - area);
+			if (const size_t tail = area + extra - (data - GUARD_SIZE); tail != 0)
+				munmap(data - GUARD_SIZE + total, tail);
+			return data;
+		}
+		return area + GUARD_SIZE;
+	}
+
+	void LinearMemory::create(size_t size, bool hugepages)
+	{
+		if (size == 0 || size % Page::size() != 0)
+			throw MachineException(ILLEGAL_OPERATION, "Invalid linear memory size", size);
+		// forks map the same file privately to get copy-on-write
+		m_fd = memfd_create("riscv-linear", MFD_CLOEXEC);
+		if (m_fd < 0 || ftruncate(m_fd, size) < 0)
+			throw MachineException(OUT_OF_MEMORY, "Unable to create linear memory", size);
+		m_hugepages = hugepages;
+		m_data = reserve(size);
+		m_size = size;
+		if (mmap(m_data, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, m_fd, 0) == MAP_FAILED)
+			throw MachineException(OUT_OF_MEMORY, "Unable to map linear memory", size);
+		// shared memory only gets them when the host allows it
+		if (m_hugepages)
+			HugePages::advise(m_data, size);
+	}
+
+	void LinearMemory::fork(const LinearMemory& parent)
+	{
+		if (parent.m_fd < 0)
+			throw MachineException(ILLEGAL_OPERATION,
+				"Forks of forks can not share linear memory");
+		m_hugepages = parent.m_hugepages;
+		m_data = reserve(parent.m_size);
+		m_size = parent.m_size;
+		if (mmap(m_data, m_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED, parent.m_fd, 0) == MAP_FAILED)
+			throw MachineException(OUT_OF_MEMORY, "Unable to map linear memory", m_size);
+	}
+
+	void LinearMemory::discard(size_t offset, size_t len)
+	{
+		if (m_fd >= 0) {
+			// drop the pages from the file, which then reads as zero
+			fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+		} else {
+			// private pages would revert to the parents memory
+			std::memset(m_data + offset, 0, len);
+		}
+	}
+
+	void LinearMemory::revert()
+	{
+		if (m_fd < 0)
+			madvise(m_data, m_size, MADV_DONTNEED);
+	}
+
+	LinearMemory::~LinearMemory()
+	{
+		if (m_data != nullptr)
+			munmap(m_data - GUARD_SIZE, m_size + 2 * GUARD_SIZE);
+		if (m_fd >= 0)
+			close(m_fd);
+	}
+}
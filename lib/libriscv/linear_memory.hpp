@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace riscv
+{
+	// One host mapping of zero-initialized memory, with an inaccessible
+	// guard page on each side. Pages are only backed when touched.
+	// A fork gets a private copy-on-write mapping of the same memory.
+	struct LinearMemory
+	{
+		LinearMemory() = default;
+		LinearMemory(const LinearMemory&) = delete;
+		LinearMemory& operator= (const LinearMemory&) = delete;
+		~LinearMemory();
+
+		// map @size bytes, which must be a multiple of the page size,
+		// optionally asking for transparent huge pages
+		void create(size_t size, bool hugepages = false);
+		// map a copy-on-write view of @parent, which must not be a fork
+		void fork(const LinearMemory& parent);
+		// give back the memory in the given range, which reads as zero again
+		void discard(size_t offset, size_t len);
+		// drop the private copies of a fork, which sees the parent again
+		void revert();
+
+		bool empty() const noexcept { return m_data == nullptr; }
+		uint8_t* data() const noexcept { return m_data; }
+		size_t size() const noexcept { return m_size; }
+
+	private:
+		uint8_t* reserve(size_t size);
+		uint8_t* m_data = nullptr;
+		size_t   m_size = 0;
+		int      m_fd   = -1;
+		bool     m_hugepages = false;
+	};
+}
@@ -30,12 +30,17 @@ namespace riscv
 		// Simulate a RISC-V machine until @max_instructions have been
 		// executed, or the machine has been stopped.
 		// NOTE: if @max_instructions is 0, then run until stop
+		// NOTE: with RISCV_BATCHED_BUDGET the limit is checked at the end
+		// of each block, and may be overshot by less than one block
 		template <bool Throw = false>
 		void simulate(uint64_t max_instructions = 0);
 
 		void stop(bool v = true) noexcept;
 		bool stopped() const noexcept;
 		void reset();
+		// drop everything a fork has changed since it was forked,
+		// which costs as much as the number of pages written to
+		void reset_to_parent();
 
 		CPU<W>    cpu;
 		Memory<W> memory;
@@ -113,6 +118,8 @@ namespace riscv
 		bool verbose_jumps     = false;
 		bool verbose_registers = false;
 		bool verbose_fp_registers = false;
+		// record instruction sequences for tuning the fused bytecodes
+		struct SequenceProfile* sequence_profile = nullptr;
 #else
 		static constexpr bool verbose_instructions = false;
 		static constexpr bool verbose_jumps     = false;
@@ -128,11 +135,31 @@ namespace riscv
 
 		// Serializes all the machine state + a tiny header to @vec
 		void serialize_to(std::vector<uint8_t>& vec);
+		// Serializes like serialize_to, but with the page data page-aligned
+		// in @vec (relative to the start of the snapshot), so that it can be
+		// written to a file and restored with deserialize_mapped
+		void serialize_aligned_to(std::vector<uint8_t>& vec);
+		// Serializes like serialize_to, but smaller: zero pages and pages
+		// found in the ELF are stored without data, identical pages only
+		// once, and the rest optionally compressed. Restored with
+		// deserialize_from, which returns -7 unless the binary is the same.
+		SnapshotStats serialize_compact_to(std::vector<uint8_t>& vec, bool compress = true);
+		// Serializes only the pages written or erased since the last
+		// snapshot taken or restored, which has to exist
+		void serialize_delta_to(std::vector<uint8_t>& vec);
 		// Returns the machine to a previously stored state
 		// NOTE: All previous memory traps are lost, syscall handlers,
 		// destructor callbacks are kept. Page fault handler and
 		// symbol lookup cache is also kept. Returns 0 on success.
+		// Deltas are applied in order on top of the snapshot they were
+		// taken after, otherwise -5 is returned. Truncated or corrupt
+		// snapshots throw a MachineException.
 		int deserialize_from(const std::vector<uint8_t>&);
+		// Restores an aligned snapshot without copying the pages, which
+		// share @data copy-on-write, eg. a MappedFile. The data must
+		// outlive the machine and its forks, and be page-aligned or -6 is
+		// returned. Deltas are applied on top with deserialize_from.
+		int deserialize_mapped(const uint8_t* data, size_t size);
 
 	private:
 		template<typename... Args, std::size_t... indices>
@@ -49,7 +49,13 @@ inline void Machine<W>::simulate(uint64_t max_instr)
 	if (max_instr != 0) {
 		max_instr += cpu.instruction_counter();
 		while (LIKELY(!this->stopped())) {
+#if defined(RISCV_THREADED_DISPATCH)
+			cpu.simulate_threaded(max_instr);
+#elif defined(RISCV_BASIC_BLOCKS)
+			cpu.simulate_block(max_instr);
+#else
 			cpu.simulate();
+#endif
 			if (UNLIKELY(cpu.instruction_counter() >= max_instr))
 				break;
 		}
@@ -62,7 +68,13 @@ inline void Machine<W>::simulate(uint64_t max_instr)
 	}
 	else {
 		while (LIKELY(!this->stopped())) {
+#if defined(RISCV_THREADED_DISPATCH)
+			cpu.simulate_threaded(UINT64_MAX);
+#elif defined(RISCV_BASIC_BLOCKS)
+			cpu.simulate_block(UINT64_MAX);
+#else
 			cpu.simulate();
+#endif
 		}
 	}
 }
@@ -74,6 +86,14 @@ inline void Machine<W>::reset()
 	memory.reset();
 }
 
+template <int W>
+inline void Machine<W>::reset_to_parent()
+{
+	memory.reset_to_parent();
+	cpu.reset_from(memory.parent()->machine().cpu);
+	m_stopped = false;
+}
+
 template <int W> inline
 void Machine<W>::install_syscall_handler(int sysn, const syscall_t& handler)
 {
@@ -151,7 +171,8 @@ inline T Machine<W>::sysarg(int idx) const
 		return cpu.registers().getfl(RISCV::REG_FA0 + idx).f64;
 	else if constexpr (std::is_same_v<T, riscv::Buffer>)
 		return memory.rvbuffer(
-			cpu.reg(RISCV::REG_ARG0 + idx), cpu.reg(RISCV::REG_ARG0 + idx + 1));
+			cpu.reg(RISCV::REG_ARG0 + idx), cpu.reg(RISCV::REG_ARG0 + idx + 1),
+			RISCV_SYSCALL_BUFFER_MAX);
 	else if constexpr (is_stdstring<T>::value)
 		return memory.memstring(cpu.reg(RISCV::REG_ARG0 + idx));
 	else if constexpr (std::is_pod_v<std::remove_reference<T>>) {
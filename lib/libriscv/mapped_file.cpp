@@ -0,0 +1,33 @@
+#include "mapped_file.hpp"
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace riscv
+{
+	MappedFile::MappedFile(const std::string& path)
+	{
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			throw std::runtime_error("Unable to open file: " + path);
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size == 0) {
+			close(fd);
+			throw std::runtime_error("Unable to map empty file: " + path);
+		}
+		// the mapping stays valid after the file is closed
+		void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+			throw std::runtime_error("Unable to map file: " + path);
+		this->m_data = (const uint8_t*) data;
+		this->m_size = st.st_size;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		munmap((void*) m_data, m_size);
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace riscv
+{
+	// A whole file mapped read-only, eg. a snapshot made with
+	// Machine::serialize_aligned_to for Machine::deserialize_mapped.
+	// Machines restored from it share its pages until they write to them.
+	struct MappedFile
+	{
+		MappedFile(const std::string& path);
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator= (const MappedFile&) = delete;
+
+		const uint8_t* data() const noexcept { return m_data; }
+		size_t size() const noexcept { return m_size; }
+
+	private:
+		const uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+	};
+}
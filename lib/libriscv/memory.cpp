@@ -2,6 +2,13 @@
 #include "machine.hpp"
 #include "decoder_cache.hpp"
 #include "elf.hpp"
+#ifdef RISCV_JIT
+#include "jit.hpp"
+#endif
+#ifdef RISCV_AOT
+#include "aot.hpp"
+#endif
+#include <algorithm>
 #include <stdexcept>
 #ifdef __GNUG__
 #include "decoder_cache.cpp"
@@ -20,7 +27,14 @@ namespace riscv
 		  m_load_program     {options.load_program},
 		  m_protect_segments {options.protect_segments},
 		  m_verbose_loader   {options.verbose_loader},
-		  m_original_machine {options.owning_machine == nullptr}
+		  m_original_machine {options.owning_machine == nullptr},
+		  m_hugepages        {options.use_hugepages}
+#ifdef RISCV_THREADED_DISPATCH
+		, m_fusion_table   {options.fusion_table}
+#endif
+#ifdef RISCV_AOT
+		, m_translation    {std::move(options.translation)}
+#endif
 	{
 		if (options.page_fault_handler != nullptr)
 		{
@@ -49,10 +63,20 @@ namespace riscv
 		}
 		// when an owning machine is passed, its state will be used instead
 		if (options.owning_machine == nullptr) {
+			if (options.linear_memory > LINEAR_BASE) {
+				const size_t pmask = Page::size()-1;
+				m_linear.create(((options.linear_memory + pmask) & ~pmask) - LINEAR_BASE,
+					options.use_hugepages);
+				this->initial_linear_pages(nullptr);
+			}
 			this->reset();
 		}
 		else {
+			m_parent = &options.owning_machine->memory;
+			if (options.lazy_fork)
+				m_master = m_parent;
 			this->machine_loader(*options.owning_machine);
+			m_dirty_pages.clear();
 		}
 	}
 	template <int W>
@@ -66,6 +90,15 @@ namespace riscv
 #endif
 #ifdef RISCV_INSTR_CACHE
 		delete[] m_decoder_cache;
+#endif
+#ifdef RISCV_JIT
+		// compiled blocks are shared with forks
+		if (this->m_original_machine)
+			delete m_jit;
+#endif
+#ifdef RISCV_AOT
+		if (this->m_original_machine)
+			delete m_aot;
 #endif
 	}
 
@@ -73,6 +106,11 @@ namespace riscv
 	void Memory<W>::reset()
 	{
 		this->clear_all_pages();
+		if (!m_linear.empty()) {
+			m_linear.discard(0, m_linear.size());
+			for (auto& page : m_linear_pages)
+				page.attr = { .non_owning = true };
+		}
 		// initialize paging (which clears all pages) before loading binary
 		this->initial_paging();
 		// load ELF binary into virtual memory
@@ -80,14 +118,53 @@ namespace riscv
 			this->binary_loader();
 	}
 
+	template <int W>
+	void Memory<W>::reset_to_parent()
+	{
+		if (m_parent == nullptr)
+			throw MachineException(ILLEGAL_OPERATION,
+				"Only forks can be reset to their parent");
+		// restoring pages adds to the list, which is dropped after.
+		// Pages freed and written again are listed more than once.
+		std::vector<address_t> dirty;
+		dirty.swap(m_dirty_pages);
+		std::sort(dirty.begin(), dirty.end());
+		dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+		for (const address_t pageno : dirty)
+		{
+			this->invalidate_page(pageno);
+			m_page_table.erase(pageno);
+			m_pages.erase(pageno);
+			// eager forks get back the CoW page from machine_loader
+			if (m_master != m_parent) {
+				auto it = m_parent->m_pages.find(pageno);
+				if (it != m_parent->m_pages.end() && !it->second.attr.dont_fork) {
+					auto attr = it->second.attr;
+					attr.is_cow = true;
+					allocate_page(pageno, attr, (PageData*) it->second.data());
+				}
+			}
+		}
+		dirty.clear();
+		m_dirty_pages.swap(dirty);
+		// the next snapshot has to be a full one
+		this->set_snapshot_id(0);
+		if (!m_linear.empty()) {
+			m_linear.revert();
+			for (size_t i = 0; i < m_linear_pages.size(); i++)
+				m_linear_pages[i].attr = m_parent->m_linear_pages[i].attr;
+		}
+	}
+
 	template <int W>
 	void Memory<W>::clear_all_pages()
 	{
 		this->m_pages.clear();
-		this->m_current_rd_page = -1;
-		this->m_current_rd_ptr  = nullptr;
-		this->m_current_wr_page = -1;
-		this->m_current_wr_ptr  = nullptr;
+		this->m_page_table.clear();
+		this->m_mapped_begin = nullptr;
+		this->m_mapped_end = nullptr;
+		// the next snapshot has to be a full one
+		this->set_snapshot_id(0);
 	}
 
 	template <int W>
@@ -99,6 +176,25 @@ namespace riscv
 		}
 	}
 
+	template <int W>
+	void Memory<W>::initial_linear_pages(const Memory* master)
+	{
+		if (master != nullptr)
+			m_linear.fork(master->m_linear);
+		m_linear_base  = m_linear.data() - LINEAR_BASE;
+		m_linear_limit = m_linear.size() - Page::size();
+		// the last page is left to the page path, so that the fast
+		// path never crosses the end of the linear memory
+		const size_t npages = m_linear.size() >> Page::SHIFT;
+		m_linear_pages.reserve(npages);
+		for (size_t i = 0; i < npages; i++) {
+			const auto attr = (master != nullptr) ?
+				master->m_linear_pages[i].attr : PageAttributes{};
+			m_linear_pages.emplace_back(attr,
+				(PageData*) &m_linear.data()[i << Page::SHIFT]);
+		}
+	}
+
 	template <int W>
 	void Memory<W>::binary_load_ph(const Phdr* hdr)
 	{
@@ -135,7 +231,13 @@ namespace riscv
 			//printf("Addr 0x%X Len %zx becomes 0x%X->0x%X PRE %zx MIDDLE %zu POST %zu TOTAL %zu\n",
 			//	hdr->p_vaddr, len, pbase, pbase + plen, prelen, len, postlen, plen);
 			// Create the whole executable memory range
-			m_exec_pagedata.reset(new uint8_t[plen]);
+			if (m_hugepages) {
+				m_exec_pagedata.reset((uint8_t*) HugePages::allocate(plen));
+				m_exec_pagedata.get_deleter() = HugePageDeleter{plen};
+			} else {
+				m_exec_pagedata.reset(new uint8_t[plen]);
+				m_exec_pagedata.get_deleter() = HugePageDeleter{};
+			}
 			m_exec_pagedata_size = plen;
 			m_exec_pagedata_base = pbase;
 			std::memset(&m_exec_pagedata[0],      0,   prelen);
@@ -144,6 +246,11 @@ namespace riscv
 			// Insert everything as non-owned memory
 			this->insert_non_owned_memory(
 				m_exec_pagedata_base, m_exec_pagedata.get(), m_exec_pagedata_size, attr);
+			// The linear memory fast path reads its own copy
+			for (size_t off = 0; off < plen; off += Page::size()) {
+				if (pbase + off - LINEAR_BASE < m_linear.size())
+					std::memcpy(&m_linear_base[pbase + off], &m_exec_pagedata[off], Page::size());
+			}
 			// This is what the CPU instruction fetcher will use
 			auto* exec_offset = m_exec_pagedata.get() - pbase;
 			machine().cpu.initialize_exec_segs(exec_offset, hdr->p_vaddr, hdr->p_vaddr + len);
@@ -269,26 +376,40 @@ namespace riscv
 	template <int W>
 	void Memory<W>::machine_loader(const Machine<W>& master)
 	{
-		for (const auto& it : master.memory.pages())
+		// lazy forks look up the masters pages when needed
+		if (m_master == nullptr)
 		{
-			const auto& page = it.second;
-			// skip pages marked as don't fork
-			if (page.attr.dont_fork) continue;
-			// just make every page CoW and non-owning
-			auto attr = page.attr;
-			attr.is_cow = true;
-			attr.non_owning = true;
-			m_pages.try_emplace(it.first, attr, (PageData*) page.data());
+			for (const auto& it : master.memory.pages())
+			{
+				const auto& page = it.second;
+				// skip pages marked as don't fork
+				if (page.attr.dont_fork) continue;
+				// just make every page CoW and non-owning
+				auto attr = page.attr;
+				attr.is_cow = true;
+				attr.non_owning = true;
+				allocate_page(it.first, attr, (PageData*) page.data());
+			}
+			// the master may itself be a lazy fork
+			m_master = master.memory.m_master;
 		}
+		if (!master.memory.m_linear.empty())
+			this->initial_linear_pages(&master.memory);
 		this->set_exit_address(master.memory.exit_address());
-		// base address, size and PC-relative data pointer for instructions
+		// base address, size and PC-relative data pointer for instructions,
+		// which only the original machine owns when forking a fork
 		this->m_exec_pagedata_base = master.memory.m_exec_pagedata_base;
 		this->m_exec_pagedata_size = master.memory.m_exec_pagedata_size;
-		this->machine().cpu.initialize_exec_segs(
-			master.memory.m_exec_pagedata.get() - m_exec_pagedata_base,
+		this->machine().cpu.initialize_exec_segs(master.cpu.exec_seg_data(),
 			m_exec_pagedata_base, m_exec_pagedata_base + m_exec_pagedata_size);
 #ifdef RISCV_INSTR_CACHE
 		this->m_exec_decoder = master.memory.m_exec_decoder;
+#ifdef RISCV_JIT
+		this->m_jit = master.memory.m_jit;
+#endif
+#ifdef RISCV_AOT
+		this->m_aot = master.memory.m_aot;
+#endif
 #endif
 
 #ifdef RISCV_RODATA_SEGMENT_IS_SHARED
@@ -3,6 +3,9 @@
 #include "elf.hpp"
 #include "types.hpp"
 #include "page.hpp"
+#include "page_table.hpp"
+#include "linear_memory.hpp"
+#include "huge_pages.hpp"
 #include <cassert>
 #include <cstring>
 #include <EASTL/allocator_malloc.h>
@@ -10,13 +13,28 @@
 #include <EASTL/string_map.h>
 #include "util/function.hpp"
 #include "util/buffer.hpp"
+#include <algorithm>
+#include <array>
 #include <numeric>
+#include <utility>
 #include <string>
 #include <vector>
 
 namespace riscv
 {
 	template<int W> struct Machine;
+#ifdef RISCV_JIT
+	template<int W> struct JIT;
+#endif
+#ifdef RISCV_AOT
+	template<int W> struct AOT;
+#endif
+
+	// one contiguous piece of host memory backing a guest range
+	struct vBuffer {
+		const char* ptr;
+		size_t len;
+	};
 
 	template<int W>
 	struct Memory
@@ -34,8 +52,13 @@ namespace riscv
 		void write(address_t dst, T value);
 
 		void memset(address_t dst, uint8_t value, size_t len);
+		// zeroes a range, returning whole pages to the shared zero page
+		void zero_range(address_t dst, size_t len);
 		void memcpy(address_t dst, const void* src, size_t);
 		void memcpy_out(void* dst, address_t src, size_t) const;
+		// copy between (possibly overlapping) guest ranges, one page span
+		// at a time, with the same permission checks as read and write
+		void memmove_guest(address_t dst, address_t src, size_t len);
 		// gives a sequential view of the data at address, with the possibility
 		// of optimizing away a copy if the data crosses no page-boundaries
 		void memview(address_t addr, size_t len,
@@ -43,6 +66,11 @@ namespace riscv
 		// gives const-ref access to pod-type T in guest memory
 		template <typename T>
 		void memview(address_t addr, Function<void(const T&)> callback) const;
+		// gives the host memory backing a guest range without copying,
+		// one entry per contiguous piece, eg. for writev or sendmsg.
+		// Returns the number of entries, and throws if @cnt is too few.
+		size_t gather_buffers_from_range(size_t cnt, vBuffer[], address_t addr, size_t len) const;
+		std::vector<vBuffer> gather_buffers_from_range(address_t addr, size_t len) const;
 		// compare bounded memory
 		int memcmp(address_t p1, address_t p2, size_t len) const;
 		int memcmp(const void* p1, address_t p2, size_t len) const;
@@ -75,6 +103,8 @@ namespace riscv
 		void print_backtrace(void(*print_function)(const char*, size_t));
 
 		// page handling
+		// NOTE: insert and erase pages through the functions below,
+		// or the page table (RISCV_FLAT_PAGE_TABLE) will be out of sync
 		size_t pages_active() const noexcept { return m_pages.size(); }
 		const auto& pages() const noexcept { return m_pages; }
 		auto& pages() noexcept { return m_pages; }
@@ -102,18 +132,51 @@ namespace riscv
 		// create pages for non-owned (shared) memory with given attributes
 		void insert_non_owned_memory(
 			address_t dst, void* src, size_t size, PageAttributes = {});
+		// memory from MachineOptions::linear_memory, which is not paged
+		bool has_linear_memory() const noexcept { return !m_linear.empty(); }
 
 #ifdef RISCV_INSTR_CACHE
 		void generate_decoder_cache(address_t addr, size_t len);
 		auto* get_decoder_cache() const { return m_exec_decoder; }
 #endif
+#ifdef RISCV_JIT
+		JIT<W>* jit() const noexcept { return m_jit; }
+#endif
+#ifdef RISCV_AOT
+		AOT<W>* aot() const noexcept { return m_aot; }
+#endif
+		// forks share the execute segment of their owning machine
+		bool is_forked() const noexcept { return !m_original_machine; }
+		const Memory* parent() const noexcept { return m_parent; }
+		// drops the pages written since forking (see Machine::reset_to_parent)
+		void reset_to_parent();
 
 		const auto& binary() const noexcept { return m_binary; }
 		void reset();
-		// serializes all the machine state + a tiny header to @vec
-		void serialize_to(std::vector<uint8_t>& vec);
+		// serializes the pages to @vec, returning the number of pages
+		size_t serialize_to(std::vector<uint8_t>& vec);
+		// serializes the page data page-aligned, followed by the page list
+		size_t serialize_aligned_to(std::vector<uint8_t>& vec);
+		// serializes the pages without repeating identical data
+		void serialize_compact_to(std::vector<uint8_t>& vec, bool compress, SnapshotStats&);
+		// serializes the pages written or erased since the last snapshot,
+		// returning the number of pages written
+		size_t serialize_delta_to(std::vector<uint8_t>& vec);
 		// returns the machine to a previously stored state
 		void deserialize_from(const std::vector<uint8_t>&, const SerializedMachine<W>&);
+		void deserialize_delta(const std::vector<uint8_t>&, const SerializedMachine<W>&);
+		void deserialize_compact(const std::vector<uint8_t>&, const SerializedMachine<W>&);
+		// installs the pages of an aligned snapshot as CoW pages that
+		// share @data, which must outlive this memory and its forks
+		void deserialize_mapped(const uint8_t* data, const SerializedMachine<W>&);
+		// the last snapshot taken or restored, which deltas build on.
+		// Writes are only tracked when it is non-zero.
+		uint64_t snapshot_id() const noexcept { return m_snapshot_id; }
+		// pages were written or erased since the last snapshot
+		bool snapshot_diverged() const noexcept {
+			return !m_snapshot_dirty.empty() || !m_snapshot_erased.empty();
+		}
+		void set_snapshot_id(uint64_t id);
 
 		Memory(Machine<W>&, std::string_view, MachineOptions<W>);
 		~Memory();
@@ -123,11 +186,41 @@ namespace riscv
 			return address >> Page::SHIFT;
 		}
 		void clear_all_pages();
+		template <typename Callback>
+		void foreach_buffer(address_t addr, size_t len, Callback) const;
+		void initial_linear_pages(const Memory* master);
+		inline Page* find_page(address_t pageno);
+		inline const Page* find_page(address_t pageno) const;
+		inline const Page* find_master_page(address_t pageno) const;
+		bool erase_page(address_t pageno);
+		bool serialized_page(const Page&, PageAttributes&) const noexcept;
+		void deserialize_pages(const uint8_t*, const SerializedMachine<W>&, bool mapped);
+		void restore_exec_pages();
+		// the offset of the guest page in the ELF, if it is loaded from there
+		int64_t binary_offset(address_t pageno) const;
+		void mark_dirty(address_t pageno, Page& page) {
+			if (m_snapshot_id != 0 && !page.dirty) {
+				page.dirty = true;
+				m_snapshot_dirty.push_back(pageno);
+			}
+		}
+		// pages of a fork that reset_to_parent restores, where a page
+		// added twice in a row (like a lazy fork's first write) is listed once
+		void add_dirty_page(address_t pageno) {
+			if (m_parent != nullptr && (m_dirty_pages.empty() || m_dirty_pages.back() != pageno))
+				m_dirty_pages.push_back(pageno);
+		}
 		void initial_paging();
-		void invalidate_page(address_t pageno, Page&);
+		void invalidate_page(address_t pageno);
+		void invalidate_all_pages();
 		[[noreturn]] static void protection_fault(address_t);
 		const Page& get_readable_page(address_t);
 		Page& get_writable_page(address_t);
+		const Page& tlb_fill_read(address_t);
+		Page& tlb_fill_write(address_t);
+		static inline size_t tlb_index(const address_t pageno) {
+			return pageno & (DATA_TLB_SIZE-1);
+		}
 		// ELF stuff
 		using Ehdr = typename Elf<W>::Ehdr;
 		using Phdr = typename Elf<W>::Phdr;
@@ -154,11 +247,37 @@ namespace riscv
 
 		Machine<W>& m_machine;
 
-		const Page* m_current_rd_ptr  = nullptr;
-		address_t   m_current_rd_page = -1;
-		Page*     m_current_wr_ptr  = nullptr;
-		address_t m_current_wr_page = -1;
+		// direct-mapped caches of readable and writable pages
+		static constexpr size_t DATA_TLB_SIZE = RISCV_DATA_TLB_SIZE;
+		static_assert((DATA_TLB_SIZE & (DATA_TLB_SIZE-1)) == 0,
+			"The data TLB size must be a power of two");
+		template <typename PageType>
+		struct CachedPage {
+			address_t pageno = -1;
+			PageType* page = nullptr;
+		};
+		std::array<CachedPage<const Page>, DATA_TLB_SIZE> m_rd_tlb;
+		std::array<CachedPage<Page>, DATA_TLB_SIZE> m_wr_tlb;
 		eastl::fixed_hash_map<address_t, Page, 128, 64>  m_pages;
+		FlatPageTable<W> m_page_table;
+		// guest memory from LINEAR_BASE backed by one host mapping
+		static constexpr address_t LINEAR_BASE = Page::size();
+		LinearMemory m_linear;
+		std::vector<Page> m_linear_pages;
+		uint8_t*  m_linear_base  = nullptr; // host address of guest address 0
+		address_t m_linear_limit = 0; // fast path below LINEAR_BASE + limit
+		// pages not found here are looked up in the master (lazy forks)
+		const Memory* m_master = nullptr;
+		// the memory this was forked from, and the pages changed since
+		const Memory* m_parent = nullptr;
+		std::vector<address_t> m_dirty_pages;
+		// pages written and erased since the last snapshot
+		uint64_t m_snapshot_id = 0;
+		std::vector<address_t> m_snapshot_dirty;
+		std::vector<address_t> m_snapshot_erased;
+		// the page data of a mapped snapshot (deserialize_mapped)
+		const uint8_t* m_mapped_begin = nullptr;
+		const uint8_t* m_mapped_end = nullptr;
 		page_fault_cb_t m_page_fault_handler = nullptr;
 		page_write_cb_t m_page_write_handler = default_page_write;
 
@@ -177,15 +296,26 @@ namespace riscv
 		const bool m_protect_segments;
 		const bool m_verbose_loader;
 		const bool m_original_machine;
+		const bool m_hugepages;
 
 		// ELF programs linear .text segment
-		std::unique_ptr<uint8_t[]> m_exec_pagedata = nullptr;
+		std::unique_ptr<uint8_t[], HugePageDeleter> m_exec_pagedata = nullptr;
 		size_t    m_exec_pagedata_size = 0;
 		address_t m_exec_pagedata_base = 0;
 #ifdef RISCV_INSTR_CACHE
-		instruction_handler<W>* m_exec_decoder = nullptr;
+		DecoderData<W>* m_exec_decoder = nullptr;
 		DecoderCache<Page::SIZE>* m_decoder_cache = nullptr;
 #endif
+#ifdef RISCV_JIT
+		JIT<W>* m_jit = nullptr;
+#endif
+#ifdef RISCV_THREADED_DISPATCH
+		const FusionTable* const m_fusion_table;
+#endif
+#ifdef RISCV_AOT
+		const std::string m_translation;
+		AOT<W>* m_aot = nullptr;
+#endif
 
 #ifdef RISCV_RODATA_SEGMENT_IS_SHARED
 		std::unique_ptr<Page[]> m_ro_pages = nullptr;
@@ -58,6 +58,46 @@ void Memory<W>::memcpy_out(void* vdst, address_t src, size_t len) const
 	}
 }
 
+template <int W>
+void Memory<W>::memmove_guest(address_t dst, address_t src, size_t len)
+{
+	// both ranges inside linear memory
+	if (dst - LINEAR_BASE < m_linear_limit && src - LINEAR_BASE < m_linear_limit
+		&& len <= m_linear_limit - (dst - LINEAR_BASE)
+		&& len <= m_linear_limit - (src - LINEAR_BASE)) {
+		std::memmove(&m_linear_base[dst], &m_linear_base[src], len);
+		return;
+	}
+	constexpr size_t PMASK = Page::size()-1;
+	// copy backwards when the destination overlaps the end of the source
+	const bool backwards = dst > src && dst - src < len;
+	while (len != 0)
+	{
+		size_t size;
+		address_t d = dst, s = src;
+		if (!backwards) {
+			size = std::min({ len, Page::size() - (d & PMASK), Page::size() - (s & PMASK) });
+		} else {
+			size = std::min({ len, ((dst + len - 1) & PMASK) + 1, ((src + len - 1) & PMASK) + 1 });
+			d = dst + len - size;
+			s = src + len - size;
+		}
+		// the destination first, as it may break CoW on the source page
+		auto& dpage = this->get_writable_page(d);
+		const auto& spage = this->get_readable_page(s);
+		if (UNLIKELY(!dpage.has_data() || !spage.has_data()))
+			protection_fault(d);
+
+		std::memmove(dpage.data() + (d & PMASK), spage.data() + (s & PMASK), size);
+
+		if (!backwards) {
+			dst += size;
+			src += size;
+		}
+		len -= size;
+	}
+}
+
 template <int W>
 void Memory<W>::memview(address_t addr, size_t len,
 	Function<void(const uint8_t*, size_t)> callback) const
@@ -104,45 +144,68 @@ void Memory<W>::memview(address_t addr,
 }
 
 template <int W>
-std::string Memory<W>::memstring(address_t addr, const size_t max_len) const
+template <typename Callback>
+void Memory<W>::foreach_buffer(address_t addr, size_t len, Callback callback) const
 {
-	std::string result;
-	size_t pageno = page_number(addr);
-	// fast-path
+	const char* last = nullptr;
+	while (len != 0)
 	{
-		address_t offset = addr & (Page::size()-1);
-		const Page& page = this->get_pageno(pageno);
+		const size_t offset = addr & (Page::size()-1);
+		const size_t size = std::min(Page::size() - offset, len);
+		const auto& page = this->get_page(addr);
 		if (UNLIKELY(!page.has_data()))
 			protection_fault(addr);
 
-		const char* start = (const char*) &page.data()[offset];
-		const char* pgend = (const char*) &page.data()[std::min(Page::size(), offset + max_len)];
-		//
-		const char* reader = start + strnlen(start, pgend - start);
-		result.append(start, reader);
-		// early exit
-		if (LIKELY(reader < pgend)) {
-			return result;
-		}
+		const char* ptr = (const char*) page.data() + offset;
+		// pages that are adjacent in host memory become one buffer
+		callback(ptr, size, ptr == last);
+		last = ptr + size;
+
+		addr += size;
+		len  -= size;
 	}
-	// slow-path: cross page-boundary
-	while (result.size() < max_len)
-	{
-		const size_t max_bytes = std::min(Page::size(), max_len - result.size());
-		pageno ++;
-		const Page& page = this->get_pageno(pageno);
-		if (UNLIKELY(!page.has_data()))
-			protection_fault(addr);
+}
 
-		const char* start = (const char*) page.data();
-		const char* endptr = (const char*) &page.data()[max_bytes];
+template <int W>
+size_t Memory<W>::gather_buffers_from_range(
+	size_t cnt, vBuffer buffers[], address_t addr, size_t len) const
+{
+	size_t index = 0;
+	foreach_buffer(addr, len,
+		[&] (const char* ptr, size_t size, bool adjacent) {
+			if (adjacent) {
+				buffers[index-1].len += size;
+				return;
+			}
+			if (UNLIKELY(index >= cnt))
+				throw MachineException(OUT_OF_MEMORY, "Out of buffers", cnt);
+			buffers[index++] = { ptr, size };
+		});
+	return index;
+}
 
-		const char* reader = start + strnlen(start, max_bytes);
-		result.append(start, reader);
-		// if we didn't stop at the page border, we must be done
-		if (reader < endptr)
-			return result;
-	}
+template <int W>
+std::vector<vBuffer> Memory<W>::gather_buffers_from_range(
+	address_t addr, size_t len) const
+{
+	std::vector<vBuffer> buffers;
+	foreach_buffer(addr, len,
+		[&] (const char* ptr, size_t size, bool adjacent) {
+			if (adjacent)
+				buffers.back().len += size;
+			else
+				buffers.push_back({ ptr, size });
+		});
+	return buffers;
+}
+
+template <int W>
+std::string Memory<W>::memstring(address_t addr, const size_t max_len) const
+{
+	// find the length first, so that the string is allocated once
+	const size_t len = this->strlen(addr, max_len);
+	std::string result(len, '\0');
+	this->memcpy_out(result.data(), addr, len);
 	return result;
 }
 
@@ -150,31 +213,14 @@ template <int W>
 riscv::Buffer Memory<W>::rvbuffer(address_t addr,
 	const size_t datalen, const size_t maxlen) const
 {
-	if (UNLIKELY(datalen + 1 >= maxlen))
-		protection_fault(addr);
-
-	size_t pageno = page_number(addr);
-	const Page& page = this->get_pageno(pageno);
-	if (UNLIKELY(!page.has_data()))
+	if (UNLIKELY(datalen >= maxlen))
 		protection_fault(addr);
 
-	const address_t offset = addr & (Page::size()-1);
-	auto* start = (const char*) &page.data()[offset];
-	const size_t max_bytes = std::min(Page::size() - offset, datalen);
-
 	riscv::Buffer result;
-	result.append_page(start, max_bytes);
-	// slow-path: cross page-boundary
-	while (result.size() < datalen)
-	{
-		const size_t max_bytes = std::min(Page::size(), datalen - result.size());
-		pageno ++;
-		const Page& page = this->get_pageno(pageno);
-		if (UNLIKELY(!page.has_data()))
-			protection_fault(addr);
-
-		result.append_page((const char*) page.data(), max_bytes);
-	}
+	foreach_buffer(addr, datalen,
+		[&result] (const char* ptr, size_t size, bool) {
+			result.append_page(ptr, size);
+		});
 	return result;
 }
 
@@ -182,93 +228,61 @@ template <int W>
 size_t Memory<W>::strlen(address_t addr, size_t maxlen) const
 {
 	size_t len = 0;
-
-	do {
-		const address_t offset = addr & (Page::size()-1);
-		size_t pageno = page_number(addr);
-		const Page& page = this->get_pageno(pageno);
+	while (len < maxlen)
+	{
+		const size_t offset = addr & (Page::size()-1);
+		const size_t size = std::min(Page::size() - offset, maxlen - len);
+		const Page& page = this->get_page(addr);
 		if (UNLIKELY(!page.has_data()))
 			protection_fault(addr);
 
-		const char* start = (const char*) &page.data()[offset];
-		const size_t max_bytes = Page::size() - offset;
-		const size_t thislen = strnlen(start, max_bytes);
+		const size_t thislen = strnlen((const char*) &page.data()[offset], size);
 		len += thislen;
-		if (thislen != max_bytes) break;
-		addr += len;
-	} while (len < maxlen);
-
-	if (len <= maxlen)
-		return len;
-	return maxlen;
+		if (thislen != size) break;
+		addr += size;
+	}
+	return len;
 }
 
 template <int W>
 int Memory<W>::memcmp(address_t p1, address_t p2, size_t len) const
 {
-	// NOTE: fast implementation if no pointer crosses page boundary
-	const auto pageno1 = this->page_number(p1);
-	const auto pageno2 = this->page_number(p2);
-	if (pageno1 == ((p1 + len-1) >> Page::SHIFT) &&
-		pageno2 == ((p2 + len-1) >> Page::SHIFT)) {
-		auto& page1 = this->get_pageno(pageno1);
-		auto& page2 = this->get_pageno(pageno2);
+	// compare the largest spans that cross no page boundary
+	while (len > 0)
+	{
+		const size_t off1 = p1 & (Page::size()-1);
+		const size_t off2 = p2 & (Page::size()-1);
+		const size_t size = std::min({ len, Page::size() - off1, Page::size() - off2 });
+		const auto& page1 = this->get_page(p1);
+		const auto& page2 = this->get_page(p2);
 		if (UNLIKELY(!page1.has_data() || !page2.has_data()))
 			protection_fault(p1);
 
-		const uint8_t* s1 = page1.data() + p1 % Page::SIZE;
-		const uint8_t* s2 = page2.data() + p2 % Page::SIZE;
-		return __builtin_memcmp(s1, s2, len);
-	}
-	else // slow path (optimizable)
-	{
-		uint8_t v1 = 0;
-		uint8_t v2 = 0;
-		while (len > 0) {
-			const auto pageno1 = this->page_number(p1);
-			const auto pageno2 = this->page_number(p2);
-			auto& page1 = this->get_pageno(pageno1);
-			auto& page2 = this->get_pageno(pageno2);
-			if (UNLIKELY(!page1.has_data() || !page2.has_data()))
-				protection_fault(p1);
-
-			v1 = page1.data()[p1 % Page::SIZE];
-			v2 = page2.data()[p2 % Page::SIZE];
-			if (v1 != v2) break;
-			p1++;
-			p2++;
-			len--;
-		}
-		return len == 0 ? 0 : (v1 - v2);
+		const int res = __builtin_memcmp(page1.data() + off1, page2.data() + off2, size);
+		if (res != 0) return res;
+		p1 += size;
+		p2 += size;
+		len -= size;
 	}
+	return 0;
 }
 template <int W>
 int Memory<W>::memcmp(const void* ptr1, address_t p2, size_t len) const
 {
-	const char* s1 = (const char*) ptr1;
-	// NOTE: fast implementation if no pointer crosses page boundary
-	const auto pageno2 = this->page_number(p2);
-	if (pageno2 == ((p2 + len-1) >> Page::SHIFT)) {
-		auto& page2 = this->get_pageno(pageno2);
-		if (UNLIKELY(!page2.has_data())) protection_fault(p2);
-
-		const uint8_t* s2 = page2.data() + p2 % Page::SIZE;
-		return __builtin_memcmp(s1, s2, len);
-	}
-	else // slow path (optimizable)
+	const uint8_t* s1 = (const uint8_t*) ptr1;
+	while (len > 0)
 	{
-		uint8_t v2 = 0;
-		while (len > 0) {
-			const auto pageno2 = this->page_number(p2);
-			auto& page2 = this->get_pageno(pageno2);
-			if (UNLIKELY(!page2.has_data())) protection_fault(p2);
+		const size_t off2 = p2 & (Page::size()-1);
+		const size_t size = std::min(len, Page::size() - off2);
+		const auto& page2 = this->get_page(p2);
+		if (UNLIKELY(!page2.has_data()))
+			protection_fault(p2);
 
-			v2 = page2.data()[p2 % Page::SIZE];
-			if (*s1 != v2) break;
-			s1++;
-			p2++;
-			len--;
-		}
-		return len == 0 ? 0 : (*s1 - v2);
+		const int res = __builtin_memcmp(s1, page2.data() + off2, size);
+		if (res != 0) return res;
+		s1 += size;
+		p2 += size;
+		len -= size;
 	}
+	return 0;
 }
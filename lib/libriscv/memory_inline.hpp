@@ -4,6 +4,9 @@ template <int W>
 template <typename T> inline
 T Memory<W>::read(address_t address)
 {
+	if (address - LINEAR_BASE < m_linear_limit) {
+		return *(T*) &m_linear_base[address];
+	}
 	const auto& page = get_readable_page(address);
 
 #ifdef RISCV_PAGE_TRAPS_ENABLED
@@ -20,6 +23,10 @@ template <int W>
 template <typename T> inline
 void Memory<W>::write(address_t address, T value)
 {
+	if (address - LINEAR_BASE < m_linear_limit) {
+		*(T*) &m_linear_base[address] = value;
+		return;
+	}
 	auto& page = get_writable_page(address);
 
 #ifdef RISCV_PAGE_TRAPS_ENABLED
@@ -48,9 +55,12 @@ inline const Page& Memory<W>::get_exec_pageno(const address_t pageno) const
 		return m_ro_pages[pageno - m_ropage_begin];
 	}
 #endif
-	auto it = m_pages.find(pageno);
-	if (LIKELY(it != m_pages.end())) {
-		return it->second;
+	const auto* page = find_page(pageno);
+	if (LIKELY(page != nullptr)) {
+		return *page;
+	}
+	if (m_master != nullptr && (page = find_master_page(pageno)) != nullptr) {
+		return *page;
 	}
 	machine().cpu.trigger_exception(EXECUTION_SPACE_PROTECTION_FAULT);
 	__builtin_unreachable();
@@ -64,21 +74,77 @@ inline const Page& Memory<W>::get_pageno(const address_t pageno) const noexcept
 		return m_ro_pages[pageno - m_ropage_begin];
 	}
 #endif
-	auto it = m_pages.find(pageno);
-	if (it != m_pages.end()) {
-		return it->second;
+	const auto* page = find_page(pageno);
+	if (page != nullptr) {
+		return *page;
+	}
+	if (m_master != nullptr && (page = find_master_page(pageno)) != nullptr) {
+		return *page;
 	}
 	// uninitialized memory is all zeroes on this system
 	return Page::cow_page();
 }
 
-template <int W> inline void
-Memory<W>::invalidate_page(address_t pageno, Page& page)
+template <int W>
+inline const Page* Memory<W>::find_page(const address_t pageno) const
 {
-	// it's only possible to a have CoW read-only page
-	if (m_current_rd_page == pageno) {
-		m_current_rd_ptr = &page;
+	const Page* page;
+	if constexpr (FlatPageTable<W>::enabled) {
+		page = m_page_table.find(pageno);
+	} else {
+		auto it = m_pages.find(pageno);
+		page = (it != m_pages.end()) ? &it->second : nullptr;
 	}
+	// pages in the linear memory always exist
+	const address_t index = pageno - (LINEAR_BASE >> Page::SHIFT);
+	if (page == nullptr && index < m_linear_pages.size())
+		return &m_linear_pages[index];
+	return page;
+}
+template <int W>
+inline Page* Memory<W>::find_page(const address_t pageno)
+{
+	return const_cast<Page*> (std::as_const(*this).find_page(pageno));
+}
+template <int W>
+inline const Page* Memory<W>::find_master_page(const address_t pageno) const
+{
+	const Page* page = m_master->find_page(pageno);
+	if (page == nullptr && m_master->m_master != nullptr)
+		return m_master->find_master_page(pageno);
+	// pages marked as don't fork are not shared
+	if (page != nullptr && page->attr.dont_fork)
+		return nullptr;
+	return page;
+}
+
+template <int W>
+inline const Page& Memory<W>::get_readable_page(const address_t address)
+{
+	const auto pageno = page_number(address);
+	const auto& entry = m_rd_tlb[tlb_index(pageno)];
+	if (LIKELY(entry.pageno == pageno))
+		return *entry.page;
+	return tlb_fill_read(address);
+}
+
+template <int W>
+inline Page& Memory<W>::get_writable_page(const address_t address)
+{
+	const auto pageno = page_number(address);
+	const auto& entry = m_wr_tlb[tlb_index(pageno)];
+	if (LIKELY(entry.pageno == pageno))
+		return *entry.page;
+	return tlb_fill_write(address);
+}
+
+template <int W> inline void
+Memory<W>::invalidate_page(address_t pageno)
+{
+	auto& rd = m_rd_tlb[tlb_index(pageno)];
+	if (rd.pageno == pageno) rd = {};
+	auto& wr = m_wr_tlb[tlb_index(pageno)];
+	if (wr.pageno == pageno) wr = {};
 }
 
 template <int W>
@@ -86,8 +152,10 @@ template <typename... Args> inline
 Page& Memory<W>::allocate_page(const size_t page, Args&&... args)
 {
 	const auto& it = pages().try_emplace(page, std::forward<Args> (args)...);
+	m_page_table.insert(page, it.first->second);
 	// if this page was read-cached, invalidate it
-	this->invalidate_page(page, it.first->second);
+	this->invalidate_page(page);
+	this->add_dirty_page(page);
 	// return new page
 	return it.first->second;
 }
@@ -3,47 +3,75 @@
 namespace riscv
 {
 	template <int W>
-	const Page& Memory<W>::get_readable_page(address_t address)
+	const Page& Memory<W>::tlb_fill_read(address_t address)
 	{
 		const auto pageno = page_number(address);
-		if (m_current_rd_page != pageno) {
-			const auto& potential = get_pageno(pageno);
-			if (UNLIKELY(!potential.attr.read)) {
-				this->protection_fault(address);
-			}
-			m_current_rd_page = pageno;
-			m_current_rd_ptr = &potential;
+		const auto& page = get_pageno(pageno);
+		if (UNLIKELY(!page.attr.read)) {
+			this->protection_fault(address);
 		}
-		return *m_current_rd_ptr;
+		m_rd_tlb[tlb_index(pageno)] = { pageno, &page };
+		return page;
 	}
 
 	template <int W>
-	Page& Memory<W>::get_writable_page(address_t address)
+	Page& Memory<W>::tlb_fill_write(address_t address)
 	{
 		const auto pageno = page_number(address);
-		if (m_current_wr_page != pageno) {
-			auto& potential = create_page(pageno);
-			if (UNLIKELY(!potential.attr.write)) {
-				this->protection_fault(address);
-			}
-			m_current_wr_page = pageno;
-			m_current_wr_ptr = &potential;
+		auto& page = create_page(pageno);
+		if (UNLIKELY(!page.attr.write)) {
+			this->protection_fault(address);
 		}
-		return *m_current_wr_ptr;
+		// a CoW page may have been replaced by a new page
+		auto& rd = m_rd_tlb[tlb_index(pageno)];
+		if (rd.pageno == pageno) rd = {};
+		m_wr_tlb[tlb_index(pageno)] = { pageno, &page };
+		return page;
+	}
+
+	template <int W>
+	void Memory<W>::set_snapshot_id(uint64_t id)
+	{
+		for (const address_t pageno : m_snapshot_dirty) {
+			if (Page* page = find_page(pageno))
+				page->dirty = false;
+		}
+		m_snapshot_dirty.clear();
+		m_snapshot_erased.clear();
+		m_snapshot_id = id;
+		// writes through the TLB have to fault in again to be seen
+		this->invalidate_all_pages();
+	}
+
+	template <int W>
+	void Memory<W>::invalidate_all_pages()
+	{
+		m_rd_tlb.fill({});
+		m_wr_tlb.fill({});
 	}
 
 	template <int W>
 	Page& Memory<W>::create_page(const address_t pageno)
 	{
-		auto it = m_pages.find(pageno);
-		if (it != m_pages.end()) {
-			Page& page = it->second;
+		Page* found = find_page(pageno);
+		if (found == nullptr && m_master != nullptr) {
+			// lazy forks get their own CoW entry on the first write
+			if (const Page* shared = find_master_page(pageno)) {
+				auto attr = shared->attr;
+				attr.is_cow = true;
+				found = &allocate_page(pageno, attr, (PageData*) shared->data());
+			}
+		}
+		if (found != nullptr) {
+			Page& page = *found;
 			if (UNLIKELY(page.attr.is_cow)) {
 				// don't enter page write handler with no-data page
 				if (UNLIKELY(!page.has_data() || !page.attr.write))
 					protection_fault(pageno * Page::size());
 				m_page_write_handler(*this, page);
+				this->add_dirty_page(pageno);
 			}
+			this->mark_dirty(pageno, page);
 			return page;
 		}
 #ifdef RISCV_RODATA_SEGMENT_IS_SHARED
@@ -52,7 +80,15 @@ namespace riscv
 		}
 #endif
 		// this callback must produce a new page, or throw
-		return m_page_fault_handler(*this, pageno);
+		Page& page = m_page_fault_handler(*this, pageno);
+		if constexpr (FlatPageTable<W>::enabled) {
+			// the handler may have inserted the page directly
+			auto it = m_pages.find(pageno);
+			if (it != m_pages.end())
+				m_page_table.insert(pageno, it->second);
+		}
+		this->mark_dirty(pageno, page);
+		return page;
 	}
 
 	template <int W>
@@ -62,10 +98,90 @@ namespace riscv
 		{
 			const size_t size = std::min(Page::size(), len);
 			const address_t pageno = dst >> Page::SHIFT;
-			auto& page = this->get_pageno(pageno);
-			if (page.attr.is_cow == false) {
-				m_pages.erase(pageno);
+			// pages shared with the master are CoW in lazy forks
+			const Page* page = this->find_page(pageno);
+			if (page != nullptr && page->attr.is_cow == false) {
+				if (!this->erase_page(pageno) && !m_linear.empty()) {
+					// linear memory pages are never removed
+					const address_t offset = (pageno << Page::SHIFT) - LINEAR_BASE;
+					if (offset < m_linear.size()) {
+						m_linear.discard(offset, Page::size());
+						m_linear_pages[offset >> Page::SHIFT].attr = { .non_owning = true };
+					}
+				}
+			}
+			dst += size;
+			len -= size;
+		}
+	}
+
+	template <int W>
+	bool Memory<W>::erase_page(address_t pageno)
+	{
+		this->invalidate_page(pageno);
+		m_page_table.erase(pageno);
+		const bool erased = m_pages.erase(pageno) != 0;
+		if (erased)
+			this->add_dirty_page(pageno);
+		// hide the masters page behind the shared zero page
+		const bool linear = pageno - (LINEAR_BASE >> Page::SHIFT) < m_linear_pages.size();
+		const bool hidden = m_master != nullptr && !linear && find_master_page(pageno) != nullptr;
+		if (hidden) {
+			allocate_page(pageno, PageAttributes{ .is_cow = true },
+				const_cast<PageData*> (&Page::cow_page().page()));
+		}
+		// only pages that could be read before are erased in a delta
+		if (m_snapshot_id != 0 && (erased || hidden))
+			m_snapshot_erased.push_back(pageno);
+		return erased;
+	}
+
+	template <int W>
+	void Memory<W>::zero_range(address_t dst, size_t len)
+	{
+		while (len > 0)
+		{
+			const size_t offset = dst & (Page::size()-1);
+			const size_t size = std::min(Page::size() - offset, len);
+			const address_t pageno = page_number(dst);
+			if (size == Page::size())
+			{
+				const address_t loff = dst - LINEAR_BASE;
+				if (loff < m_linear.size()) {
+					m_linear.discard(loff, Page::size());
+					dst += size;
+					len -= size;
+					continue;
+				}
+				const Page* page = find_page(pageno);
+				if (page == nullptr && m_master != nullptr)
+					page = find_master_page(pageno);
+				// missing pages already read as zeroes
+				if (page == nullptr) {
+					dst += size;
+					len -= size;
+					continue;
+				}
+				// only plain read-write pages can be dropped
+				const auto& attr = page->attr;
+				bool droppable = attr.is_default() && !attr.dont_fork
+					&& attr.user_defined == 0 && (attr.is_cow || !attr.non_owning);
+#ifdef RISCV_PAGE_TRAPS_ENABLED
+				droppable = droppable && !page->has_trap();
+#endif
+				if (droppable)
+				{
+					this->erase_page(pageno);
+					dst += size;
+					len -= size;
+					continue;
+				}
 			}
+			auto& page = this->create_page(pageno);
+			if (UNLIKELY(!page.has_data()))
+				protection_fault(dst);
+			__builtin_memset(page.data() + offset, 0, size);
+
 			dst += size;
 			len -= size;
 		}
@@ -116,8 +232,7 @@ namespace riscv
 		attr.non_owning = true;
 		// NOTE: If you insert a const Page, DON'T modify it! The machine
 		// won't, unless system-calls do or manual intervention happens!
-		m_pages.try_emplace(pageno, attr, const_cast<PageData*> (&shared_page.page()));
-		return m_pages[pageno];
+		return allocate_page(pageno, attr, const_cast<PageData*> (&shared_page.page()));
 	}
 
 	template <int W>
@@ -132,28 +247,37 @@ namespace riscv
 		{
 			const auto pageno = (dst + i) >> Page::SHIFT;
 			PageData* pdata = reinterpret_cast<PageData*> ((char*) src + i);
-			m_pages.try_emplace(pageno, attr, pdata);
+			allocate_page(pageno, attr, pdata);
 		}
 	}
 
 	template <int W> void
 	Memory<W>::set_page_attr(address_t dst, size_t len, PageAttributes options)
 	{
+		// the page keeps its ownership of the data
+		const auto set_attr = [&options] (Page& page) {
+			const bool non_owning = page.attr.non_owning;
+			page.attr = options;
+			page.attr.non_owning = non_owning;
+		};
 		const bool is_default = options.is_default();
 		while (len > 0)
 		{
 			const size_t size = std::min(Page::size(), len);
 			const address_t pageno = page_number(dst);
+			// cached permissions are no longer valid
+			this->invalidate_page(pageno);
 			// unfortunately, have to create pages for non-default attrs
 			if (!is_default) {
-				this->create_page(pageno).attr = options;
+				set_attr(this->create_page(pageno));
 			} else {
 				// set attr on non-COW pages only!
-				const auto& page = this->get_pageno(pageno);
+				const bool shared = m_master != nullptr && find_page(pageno) == nullptr;
+				const auto& page = shared ? Page::cow_page() : this->get_pageno(pageno);
 				if (page.attr.is_cow == false) {
 					// this page has been written to, or had attrs set,
 					// otherwise it would still be CoW.
-					this->create_page(pageno).attr = options;
+					set_attr(this->create_page(pageno));
 				}
 			}
 
@@ -7,6 +7,9 @@
 #include "common.hpp"
 #include "decoder_cache.hpp"
 #include "util/function.hpp"
+#ifdef RISCV_PAGE_POOL
+#include "page_pool.hpp"
+#endif
 
 namespace riscv {
 
@@ -31,6 +34,17 @@ struct alignas(8) PageData {
 	static constexpr unsigned SHIFT = 12;
 
 	std::array<uint8_t, SIZE> buffer8 = {0};
+
+#ifdef RISCV_PAGE_POOL
+	static void* operator new(size_t size) {
+		assert(size == sizeof(PageData));
+		(void) size;
+		return PagePool::allocate();
+	}
+	static void operator delete(void* ptr) noexcept {
+		PagePool::deallocate(ptr);
+	}
+#endif
 };
 
 struct Page
@@ -45,10 +59,11 @@ struct Page
 	Page(const PageAttributes& a, const PageData& d = {})
 		: attr(a), m_page(new PageData{d}) { attr.non_owning = false; }
 	Page(Page&& other)
-		: attr(other.attr), m_page(std::move(other.m_page)) {}
+		: attr(other.attr), m_page(std::move(other.m_page)), dirty(other.dirty) {}
 	Page& operator= (Page&& other) {
 		attr = other.attr;
 		m_page = std::move(other.m_page);
+		dirty = other.dirty;
 		return *this;
 	}
 	// create a page that doesn't own this memory
@@ -117,6 +132,8 @@ struct Page
 	// page-aligning the PageData struct and putting it first
 	PageAttributes attr;
 	std::unique_ptr<PageData> m_page;
+	// written to since the last snapshot (see Memory::snapshot_id)
+	bool dirty = false;
 #ifdef RISCV_PAGE_TRAPS_ENABLED
 	bool has_trap() const noexcept { return m_trap != nullptr; }
 	void set_trap(mmio_cb_t newtrap) noexcept { this->m_trap = newtrap; }
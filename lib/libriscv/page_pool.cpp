@@ -0,0 +1,163 @@
+#include "page_pool.hpp"
+#include "page.hpp"
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef RISCV_PAGE_POOL_MAX
+#define RISCV_PAGE_POOL_MAX  4096
+#endif
+
+namespace riscv
+{
+	static constexpr size_t BLOCK_SIZE = sizeof(PageData);
+	static constexpr size_t LOCAL_MAX  = 64;
+	static constexpr size_t BATCH      = LOCAL_MAX / 2;
+	static constexpr size_t SHARED_MAX = RISCV_PAGE_POOL_MAX;
+
+	struct SharedPool {
+		std::mutex lock;
+		std::vector<void*> blocks;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+	};
+	// never destroyed, as static pages can be freed at exit
+	static SharedPool& shared_pool() {
+		static SharedPool* pool = new SharedPool;
+		return *pool;
+	}
+
+	struct LocalCache {
+		void*    blocks[LOCAL_MAX];
+		size_t   count = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		bool     registered = false;
+		bool     exited = false;
+	};
+	static thread_local LocalCache local_cache;
+
+	// must be called with the shared pool locked
+	static void flush_counters(SharedPool& pool, LocalCache& cache)
+	{
+		pool.hits += cache.hits;
+		pool.misses += cache.misses;
+		cache.hits = 0;
+		cache.misses = 0;
+	}
+	static void give_back(SharedPool& pool, void* block)
+	{
+		if (pool.blocks.size() < SHARED_MAX)
+			pool.blocks.push_back(block);
+		else
+			std::free(block);
+	}
+
+	// returns the cached blocks to the shared pool on thread exit
+	struct LocalFlush {
+		~LocalFlush() {
+			auto& cache = local_cache;
+			auto& pool = shared_pool();
+			std::lock_guard<std::mutex> guard(pool.lock);
+			while (cache.count > 0)
+				give_back(pool, cache.blocks[--cache.count]);
+			flush_counters(pool, cache);
+			cache.exited = true;
+		}
+	};
+	static thread_local LocalFlush local_flush;
+	// thread_local destructors only run for objects that were used
+	static void register_flush(LocalCache& cache)
+	{
+		(void) &local_flush;
+		cache.registered = true;
+	}
+
+	void* PagePool::allocate()
+	{
+		auto& cache = local_cache;
+		if (LIKELY(cache.count > 0)) {
+			cache.hits ++;
+			return cache.blocks[--cache.count];
+		}
+		if (!cache.registered)
+			register_flush(cache);
+		{
+			auto& pool = shared_pool();
+			std::lock_guard<std::mutex> guard(pool.lock);
+			while (cache.count < BATCH && !pool.blocks.empty()) {
+				cache.blocks[cache.count++] = pool.blocks.back();
+				pool.blocks.pop_back();
+			}
+			flush_counters(pool, cache);
+		}
+		if (cache.count > 0) {
+			cache.hits ++;
+			return cache.blocks[--cache.count];
+		}
+		cache.misses ++;
+		void* block = std::aligned_alloc(BLOCK_SIZE, BLOCK_SIZE);
+		if (UNLIKELY(block == nullptr))
+			throw std::bad_alloc();
+		return block;
+	}
+
+	void PagePool::deallocate(void* block) noexcept
+	{
+		auto& cache = local_cache;
+		if (LIKELY(cache.count < LOCAL_MAX && !cache.exited)) {
+			// threads that only free pages also flush on exit
+			if (UNLIKELY(!cache.registered))
+				register_flush(cache);
+			cache.blocks[cache.count++] = block;
+			return;
+		}
+		auto& pool = shared_pool();
+		std::lock_guard<std::mutex> guard(pool.lock);
+		if (!cache.exited) {
+			// move half of the local cache to the shared pool
+			while (cache.count > LOCAL_MAX - BATCH)
+				give_back(pool, cache.blocks[--cache.count]);
+			flush_counters(pool, cache);
+			cache.blocks[cache.count++] = block;
+			return;
+		}
+		give_back(pool, block);
+	}
+
+	PagePool::Stats PagePool::stats() noexcept
+	{
+		auto& cache = local_cache;
+		auto& pool = shared_pool();
+		std::lock_guard<std::mutex> guard(pool.lock);
+		return Stats {
+			.hits   = pool.hits + cache.hits,
+			.misses = pool.misses + cache.misses,
+			.pooled = pool.blocks.size()
+		};
+	}
+
+	void PagePool::trim(size_t keep)
+	{
+		auto& pool = shared_pool();
+		std::lock_guard<std::mutex> guard(pool.lock);
+		while (pool.blocks.size() > keep) {
+			std::free(pool.blocks.back());
+			pool.blocks.pop_back();
+		}
+	}
+
+	void PagePool::release_memory()
+	{
+		// only whole host pages can be released
+		if (sysconf(_SC_PAGESIZE) != (long) BLOCK_SIZE)
+			return;
+		auto& pool = shared_pool();
+		std::lock_guard<std::mutex> guard(pool.lock);
+		for (void* block : pool.blocks)
+			madvise(block, BLOCK_SIZE, MADV_DONTNEED);
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace riscv
+{
+	// Recycles the 4 KiB blocks of page data (RISCV_PAGE_POOL). Each
+	// thread keeps a small cache of free blocks and exchanges them in
+	// batches with a shared pool, so that short-lived forks rarely
+	// end up in malloc and free.
+	struct PagePool
+	{
+		static void* allocate();
+		static void  deallocate(void*) noexcept;
+
+		struct Stats {
+			uint64_t hits;   // allocations served by the pool
+			uint64_t misses; // allocations that went to malloc
+			size_t   pooled; // free blocks in the shared pool
+		};
+		// NOTE: counts from other threads are included once they
+		// have exchanged blocks with the shared pool
+		static Stats stats() noexcept;
+
+		// free pooled blocks until @keep blocks remain
+		static void trim(size_t keep = 0);
+		// give the physical memory of all pooled blocks back to the
+		// system with madvise(MADV_DONTNEED), keeping the blocks
+		static void release_memory();
+	};
+}
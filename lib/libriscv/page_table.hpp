@@ -0,0 +1,58 @@
+#pragma once
+#include "page.hpp"
+#include <array>
+#include <memory>
+
+namespace riscv
+{
+	// Page lookup table mirroring Memory::m_pages. Without
+	// RISCV_FLAT_PAGE_TABLE, and for 64-bit machines, it is empty
+	// and all lookups go through the hash map.
+	template <int W>
+	struct FlatPageTable
+	{
+		static constexpr bool enabled = false;
+
+		Page* find(size_t) const noexcept { return nullptr; }
+		void insert(size_t, Page&) {}
+		void erase(size_t) noexcept {}
+		void clear() noexcept {}
+	};
+
+#ifdef RISCV_FLAT_PAGE_TABLE
+	// Two-level table of pointers to every page of a 32-bit address
+	// space (2^20 pages), so that a lookup is two loads. The second
+	// level is allocated on first use. The pages are owned by m_pages.
+	template <>
+	struct FlatPageTable<4>
+	{
+		static constexpr bool enabled = true;
+		static constexpr unsigned L2_BITS = 10;
+		static constexpr unsigned L2_SIZE = 1u << L2_BITS;
+		static constexpr unsigned L1_SIZE = 1u << (32 - Page::SHIFT - L2_BITS);
+
+		Page* find(uint32_t pageno) const noexcept {
+			const auto& l2 = m_l1[pageno >> L2_BITS];
+			return (l2 != nullptr) ? (*l2)[pageno & (L2_SIZE-1)] : nullptr;
+		}
+		void insert(uint32_t pageno, Page& page) {
+			auto& l2 = m_l1[pageno >> L2_BITS];
+			if (l2 == nullptr) l2.reset(new L2Table {});
+			(*l2)[pageno & (L2_SIZE-1)] = &page;
+		}
+		void erase(uint32_t pageno) noexcept {
+			auto& l2 = m_l1[pageno >> L2_BITS];
+			if (l2 != nullptr) (*l2)[pageno & (L2_SIZE-1)] = nullptr;
+		}
+		// keep the second level tables, they are likely to be reused
+		void clear() noexcept {
+			for (auto& l2 : m_l1)
+				if (l2 != nullptr) l2->fill(nullptr);
+		}
+
+	private:
+		using L2Table = std::array<Page*, L2_SIZE>;
+		std::array<std::unique_ptr<L2Table>, L1_SIZE> m_l1;
+	};
+#endif
+}
@@ -23,7 +23,8 @@ namespace riscv
 	template<>
 	void CPU<4>::execute(const format_t instruction)
 	{
-#define DECODER(x) x.handler(*this, instruction); return;
+// one statement, as it is used after if without braces
+#define DECODER(x) { x.handler(*this, instruction); return; }
 #include "rv32_instr.inc"
 #undef DECODER
 	}
@@ -1,5 +1,7 @@
 #include "rv32i.hpp"
 #include "instr_helpers.hpp"
+#include <array>
+#include <utility>
 
 namespace riscv
 {
@@ -577,6 +579,69 @@ namespace riscv
 		dst = src1 - src2;
 	}, DECODED_INSTR(OP).printer);
 
+	// Variants of the hottest instructions specialized on the most
+	// common registers (ra, sp, a0-a5) for rd and rs1, so that the
+	// register accesses become constant offsets.
+	template <int W>
+	static constexpr int instruction_width(const Instruction<W>&) { return W; }
+	static constexpr int SPECIALIZED_W = instruction_width(DECODED_INSTR(NOP));
+
+	static constexpr std::array<uint8_t, 8> specialized_regs {
+		1, 2, 10, 11, 12, 13, 14, 15
+	};
+	static constexpr auto specialized_slots = [] {
+		std::array<int8_t, 32> slots {};
+		for (auto& slot : slots) slot = -1;
+		for (size_t i = 0; i < specialized_regs.size(); i++)
+			slots[specialized_regs[i]] = i;
+		return slots;
+	}();
+	// index into a table of specialized instructions, or -1
+	static constexpr int specialized_index(unsigned rd, unsigned rs1) {
+		if (specialized_slots[rd] < 0 || specialized_slots[rs1] < 0)
+			return -1;
+		return specialized_slots[rd] * specialized_regs.size() + specialized_slots[rs1];
+	}
+
+	template <template <unsigned, unsigned> class Op, size_t... I>
+	static constexpr auto specialized_table(
+		instruction_printer<SPECIALIZED_W> printer, std::index_sequence<I...>)
+	{
+		constexpr size_t N = specialized_regs.size();
+		return std::array<Instruction<SPECIALIZED_W>, sizeof...(I)> {{
+			{ &Op<specialized_regs[I / N], specialized_regs[I % N]>::handler, printer }...
+		}};
+	}
+	static constexpr auto specialized_indices =
+		std::make_index_sequence<specialized_regs.size() * specialized_regs.size()> ();
+
+	template <unsigned RD, unsigned RS1>
+	struct SpecializedAddi {
+		static void handler(CPU<SPECIALIZED_W>& cpu, rv32i_instruction instr) {
+			cpu.reg(RD) = cpu.reg(RS1) + instr.Itype.signed_imm();
+		}
+	};
+	template <unsigned RD, unsigned RS1>
+	struct SpecializedAdd {
+		static void handler(CPU<SPECIALIZED_W>& cpu, rv32i_instruction instr) {
+			cpu.reg(RD) = cpu.reg(RS1) + cpu.reg(instr.Rtype.rs2);
+		}
+	};
+	template <unsigned RD, unsigned RS1>
+	struct SpecializedLoadI32 {
+		static void handler(CPU<SPECIALIZED_W>& cpu, rv32i_instruction instr) {
+			const auto addr = cpu.reg(RS1) + instr.Itype.signed_imm();
+			cpu.reg(RD) = (RVSIGNTYPE(cpu)) (int32_t)
+				cpu.machine().memory.template read<uint32_t>(addr);
+		}
+	};
+	static constexpr auto DECODED_INSTR(OP_IMM_ADDI_REGS) = specialized_table<SpecializedAddi>
+		(DECODED_INSTR(OP_IMM).printer, specialized_indices);
+	static constexpr auto DECODED_INSTR(OP_ADD_REGS) = specialized_table<SpecializedAdd>
+		(DECODED_INSTR(OP).printer, specialized_indices);
+	static constexpr auto DECODED_INSTR(LOAD_I32_REGS) = specialized_table<SpecializedLoadI32>
+		(DECODED_INSTR(LOAD_I8).printer, specialized_indices);
+
 	INSTRUCTION(SYSTEM,
 	[] (auto& cpu, rv32i_instruction instr) {
 		extern uint64_t u64_monotonic_time();
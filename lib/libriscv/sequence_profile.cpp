@@ -0,0 +1,158 @@
+#include "sequence_profile.hpp"
+#include "threaded_bytecodes.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <vector>
+
+namespace riscv
+{
+	uint32_t SequenceProfile::key(const uint8_t* bytecodes, unsigned count)
+	{
+		uint32_t key = count << 24;
+		for (unsigned i = 0; i < count; i++)
+			key |= (uint32_t) bytecodes[i] << (8 * i);
+		return key;
+	}
+
+	void SequenceProfile::record(uint64_t pc, uint8_t bytecode, bool is_long)
+	{
+		m_instructions ++;
+		if (!is_long) {
+			m_window_len = 0;
+			return;
+		}
+		// anything but the next instruction starts a new sequence
+		if (pc != m_next_pc)
+			m_window_len = 0;
+		m_next_pc = pc + 4;
+
+		if (m_window_len >= 1) {
+			const uint8_t pair[] = { m_window[m_window_len-1], bytecode };
+			m_pairs[key(pair, 2)] ++;
+		}
+		if (m_window_len >= 2) {
+			const uint8_t triple[] = { m_window[0], m_window[1], bytecode };
+			m_triples[key(triple, 3)] ++;
+		}
+		if (m_window_len < 2) {
+			m_window[m_window_len++] = bytecode;
+		} else {
+			m_window[0] = m_window[1];
+			m_window[1] = bytecode;
+		}
+	}
+
+	void SequenceProfile::clear()
+	{
+		m_pairs.clear();
+		m_triples.clear();
+		m_instructions = 0;
+		m_window_len = 0;
+	}
+
+	using sequence_list = std::vector<std::pair<uint32_t, uint64_t>>;
+	static sequence_list top_sequences(
+		const std::unordered_map<uint32_t, uint64_t>& map, size_t top)
+	{
+		sequence_list list { map.begin(), map.end() };
+		std::sort(list.begin(), list.end(),
+			[] (const auto& a, const auto& b) {
+				return a.second > b.second || (a.second == b.second && a.first < b.first);
+			});
+		if (list.size() > top)
+			list.resize(top);
+		return list;
+	}
+
+	static std::string sequence_names(uint32_t key, const char* separator)
+	{
+		std::string result;
+		const unsigned count = key >> 24;
+		for (unsigned i = 0; i < count; i++) {
+			if (i > 0) result += separator;
+			result += threaded_bytecode_name((threaded_bytecode) ((key >> (8 * i)) & 0xFF));
+		}
+		return result;
+	}
+
+	std::string SequenceProfile::report(size_t top) const
+	{
+		std::string result;
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer),
+			"Sequence profile: %lu instructions\n", (unsigned long) m_instructions);
+		result += buffer;
+		for (const auto* map : { &m_pairs, &m_triples })
+		{
+			result += (map == &m_pairs) ? "Top pairs:\n" : "Top triples:\n";
+			for (const auto& it : top_sequences(*map, top))
+			{
+				// show which fused bytecode, if any, covers the sequence
+				std::array<threaded_bytecode, 3> bc{};
+				const unsigned count = it.first >> 24;
+				for (unsigned i = 0; i < count; i++)
+					bc[i] = (threaded_bytecode) ((it.first >> (8 * i)) & 0xFF);
+				auto fused = threaded_fused_bytecode_for<4> (bc.data(), count);
+				if (threaded_bytecode_length(fused) != count)
+					fused = threaded_fused_bytecode_for<8> (bc.data(), count);
+				const bool is_fused = threaded_bytecode_length(fused) == count;
+				snprintf(buffer, sizeof(buffer), "%12lu  %5.2f%%  %s%s%s\n",
+					(unsigned long) it.second,
+					100.0 * it.second / std::max(m_instructions, (uint64_t) 1),
+					sequence_names(it.first, " -> ").c_str(),
+					is_fused ? "  => " : "",
+					is_fused ? threaded_bytecode_name(fused) : "");
+				result += buffer;
+			}
+		}
+		return result;
+	}
+
+	std::string SequenceProfile::table(size_t top) const
+	{
+		std::string result;
+		char buffer[256];
+		for (const auto* map : { &m_pairs, &m_triples })
+		{
+			for (const auto& it : top_sequences(*map, top))
+			{
+				snprintf(buffer, sizeof(buffer), "%lu %s\n",
+					(unsigned long) it.second, sequence_names(it.first, " ").c_str());
+				result += buffer;
+			}
+		}
+		return result;
+	}
+
+	FusionTable FusionTable::parse(std::string_view text, uint64_t min_count)
+	{
+		FusionTable table;
+		while (!text.empty())
+		{
+			const size_t eol = std::min(text.find('\n'), text.size());
+			const std::string line { text.substr(0, eol) };
+			text.remove_prefix(std::min(eol + 1, text.size()));
+
+			char names[3][32];
+			unsigned long count = 0;
+			const int n = sscanf(line.c_str(), "%lu %31s %31s %31s",
+				&count, names[0], names[1], names[2]);
+			if (n < 3 || count < min_count)
+				continue;
+			uint8_t bytecodes[3];
+			bool valid = true;
+			for (int i = 0; i < n - 1; i++) {
+				unsigned bc = 0;
+				while (bc < RV32I_BC_MAX &&
+					std::string_view(threaded_bytecode_name((threaded_bytecode) bc)) != names[i])
+					bc++;
+				valid = valid && (bc < RV32I_BC_MAX);
+				bytecodes[i] = bc;
+			}
+			if (valid)
+				table.m_sequences.insert(SequenceProfile::key(bytecodes, n - 1));
+		}
+		return table;
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace riscv
+{
+	// Frequencies of consecutive pairs and triples of 4-byte instructions,
+	// as threaded bytecodes, recorded by CPU<W>::simulate with RISCV_DEBUG
+	// when Machine::sequence_profile is set. Jumps and compressed
+	// instructions end a sequence.
+	struct SequenceProfile
+	{
+		void record(uint64_t pc, uint8_t bytecode, bool is_long);
+
+		// human-readable report of the @top most common sequences
+		std::string report(size_t top = 20) const;
+		// one sequence per line: count, then bytecode names,
+		// which can be loaded with FusionTable::parse()
+		std::string table(size_t top = 50) const;
+
+		uint64_t instructions() const noexcept { return m_instructions; }
+		void clear();
+
+		// up to 3 bytecodes packed into a key, first bytecode lowest
+		static uint32_t key(const uint8_t* bytecodes, unsigned count);
+
+	private:
+		std::unordered_map<uint32_t, uint64_t> m_pairs;
+		std::unordered_map<uint32_t, uint64_t> m_triples;
+		uint64_t m_instructions = 0;
+		uint64_t m_next_pc = 0;
+		uint8_t  m_window[2];
+		unsigned m_window_len = 0;
+	};
+
+	// The sequences that the decoder cache generation is allowed to
+	// fuse, see MachineOptions::fusion_table. Sequences that have no
+	// fused bytecode are ignored.
+	struct FusionTable
+	{
+		// parse the format written by SequenceProfile::table(),
+		// keeping sequences that were seen at least @min_count times
+		static FusionTable parse(std::string_view text, uint64_t min_count = 1);
+
+		bool contains(const uint8_t* bytecodes, unsigned count) const {
+			return m_sequences.count(SequenceProfile::key(bytecodes, count)) != 0;
+		}
+		size_t size() const noexcept { return m_sequences.size(); }
+
+	private:
+		std::unordered_set<uint32_t> m_sequences;
+	};
+}
@@ -1,17 +1,31 @@
 #include <libriscv/machine.hpp>
+#include <libriscv/util/hash.hpp>
+#include <libriscv/util/lz.hpp>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
 
 namespace riscv
 {
-	static const uint64_t MAGiC_V4LUE = 0x9c36ab9301aed873;
+	static const uint64_t MAGiC_V4LUE = 0x9c36ab9301aed874;
+	// bumped whenever the snapshot layout changes
+	static const uint32_t SNAPSHOT_VERSION = 2;
+	// only the pages changed since the parent snapshot
+	static const uint16_t FLAG_DELTA = 0x1;
+	// the page data is page-aligned and the page list follows it
+	static const uint16_t FLAG_ALIGNED = 0x2;
+	// each page has a CompactPage record, with data only when needed
+	static const uint16_t FLAG_COMPACT = 0x4;
 	template <int W>
 	struct SerializedMachine
 	{
 		uint64_t magic;
+		uint32_t version;
 		uint32_t n_pages;
 		uint16_t reg_size;
 		uint16_t page_size;
 		uint16_t attr_size;
-		uint16_t reserved;
+		uint16_t flags;
 		uint16_t cpu_offset;
 		uint16_t mem_offset;
 
@@ -21,75 +35,355 @@ namespace riscv
 		uint64_t start_address = 0;
 		uint64_t stack_address = 0;
 		uint64_t exit_address  = 0;
+
+		uint64_t snapshot_id = 0;
+		uint64_t parent_id   = 0;
+		// compact snapshots refer to pages of this binary
+		uint64_t binary_hash = 0;
 	};
 	struct SerializedPage
 	{
 		uint64_t addr;
 		PageAttributes attr;
 	};
+	enum CompactKind : uint16_t {
+		PAGE_ZERO,       // no data
+		PAGE_BINARY,     // ref is the offset in the ELF
+		PAGE_DUPLICATE,  // ref is the addr of an earlier page
+		PAGE_RAW,        // followed by the page data
+		PAGE_COMPRESSED, // followed by size bytes of lz data
+	};
+	struct CompactPage
+	{
+		uint64_t addr;
+		PageAttributes attr;
+		uint16_t kind = PAGE_ZERO;
+		uint32_t size = 0;
+		uint64_t ref  = 0;
+	};
+
+	static uint64_t new_snapshot_id()
+	{
+		static thread_local std::mt19937_64 gen { std::random_device{}() };
+		uint64_t id;
+		do { id = gen(); } while (id == 0);
+		return id;
+	}
 
 	template <int W>
-	void Machine<W>::serialize_to(std::vector<uint8_t>& vec)
+	static SerializedMachine<W> make_header(const Machine<W>& m, uint16_t flags)
 	{
-		const SerializedMachine<W> header {
+		// the linear memory is not tracked by pages
+		if (m.memory.has_linear_memory())
+			throw MachineException(ILLEGAL_OPERATION,
+				"Machines with linear memory can not be serialized");
+		return SerializedMachine<W> {
 			.magic    = MAGiC_V4LUE,
-			.n_pages  = (unsigned) memory.nonshared_pages_active(),
+			.version  = SNAPSHOT_VERSION,
+			.n_pages  = 0,
 			.reg_size = sizeof(Registers<W>),
 			.page_size = Page::size(),
 			.attr_size = sizeof(PageAttributes),
-			.reserved = 0,
+			.flags    = flags,
 			.cpu_offset = sizeof(SerializedMachine<W>),
 			.mem_offset = sizeof(SerializedMachine<W>),
 
-			.registers = cpu.registers(),
-			.counter   = cpu.instruction_counter(),
+			.registers = m.cpu.registers(),
+			.counter   = m.cpu.instruction_counter(),
+
+			.start_address = m.memory.start_address(),
+			.stack_address = m.memory.stack_initial(),
+			.exit_address  = m.memory.exit_address(),
 
-			.start_address = memory.start_address(),
-			.stack_address = memory.stack_initial(),
-			.exit_address  = memory.exit_address(),
+			.snapshot_id = new_snapshot_id(),
+			.parent_id   = m.memory.snapshot_id(),
 		};
+	}
+	template <int W>
+	static void append_header(std::vector<uint8_t>& vec, const SerializedMachine<W>& header)
+	{
 		const auto* hptr = (const uint8_t*) &header;
 		vec.insert(vec.end(), hptr, hptr + sizeof(header));
+	}
+
+	template <int W>
+	void Machine<W>::serialize_to(std::vector<uint8_t>& vec)
+	{
+		auto header = make_header(*this, 0);
+		const size_t hoff = vec.size();
+		append_header(vec, header);
 		this->cpu.serialize_to(vec);
-		this->memory.serialize_to(vec);
+		header.n_pages = this->memory.serialize_to(vec);
+		std::memcpy(&vec[hoff], &header, sizeof(header));
+		// start tracking the pages written from here on
+		this->memory.set_snapshot_id(header.snapshot_id);
+	}
+	template <int W>
+	void Machine<W>::serialize_aligned_to(std::vector<uint8_t>& vec)
+	{
+		static_assert(sizeof(SerializedMachine<W>) <= Page::size());
+		auto header = make_header(*this, FLAG_ALIGNED);
+		header.mem_offset = Page::size();
+		const size_t hoff = vec.size();
+		append_header(vec, header);
+		this->cpu.serialize_to(vec);
+		assert(vec.size() <= hoff + Page::size());
+		vec.resize(hoff + Page::size());
+		header.n_pages = this->memory.serialize_aligned_to(vec);
+		std::memcpy(&vec[hoff], &header, sizeof(header));
+		this->memory.set_snapshot_id(header.snapshot_id);
+	}
+	template <int W>
+	SnapshotStats Machine<W>::serialize_compact_to(std::vector<uint8_t>& vec, bool compress)
+	{
+		auto header = make_header(*this, FLAG_COMPACT);
+		header.binary_hash = fnv1a_hash(memory.binary());
+		const size_t hoff = vec.size();
+		append_header(vec, header);
+		this->cpu.serialize_to(vec);
+		SnapshotStats stats;
+		this->memory.serialize_compact_to(vec, compress, stats);
+		header.n_pages = stats.pages;
+		std::memcpy(&vec[hoff], &header, sizeof(header));
+		stats.bytes = vec.size() - hoff;
+		this->memory.set_snapshot_id(header.snapshot_id);
+		return stats;
+	}
+	template <int W>
+	void Machine<W>::serialize_delta_to(std::vector<uint8_t>& vec)
+	{
+		if (memory.snapshot_id() == 0)
+			throw MachineException(ILLEGAL_OPERATION,
+				"Delta snapshots need a previous snapshot");
+		auto header = make_header(*this, FLAG_DELTA);
+		const size_t hoff = vec.size();
+		append_header(vec, header);
+		this->cpu.serialize_to(vec);
+		header.n_pages = this->memory.serialize_delta_to(vec);
+		std::memcpy(&vec[hoff], &header, sizeof(header));
+		this->memory.set_snapshot_id(header.snapshot_id);
 	}
 	template <int W>
 	void CPU<W>::serialize_to(std::vector<uint8_t>& /* vec */)
 	{
 	}
 	template <int W>
-	void Memory<W>::serialize_to(std::vector<uint8_t>& vec)
+	bool Memory<W>::serialized_page(const Page& page, PageAttributes& attr) const noexcept
+	{
+		attr = page.attr;
+		// pages shared with a mapped snapshot are stored as owned pages
+		const auto* data = (const uint8_t*) page.data();
+		if (attr.non_owning && data >= m_mapped_begin && data < m_mapped_end) {
+			attr.is_cow = false;
+			attr.non_owning = false;
+		}
+		// we want to ignore shared/non-owned pages
+		if (attr.non_owning) return false;
+		assert(!attr.is_cow && "Should never have CoW pages stored");
+		return true;
+	}
+	template <int W>
+	size_t Memory<W>::serialize_to(std::vector<uint8_t>& vec)
 	{
 		const size_t est_page_bytes =
 			this->m_pages.size() * (sizeof(SerializedPage) + Page::size());
 		vec.reserve(vec.size() + est_page_bytes);
 
+		size_t n_pages = 0;
+		for (const auto& it : this->m_pages)
+		{
+			SerializedPage spage { .addr = it.first, .attr = {} };
+			if (!serialized_page(it.second, spage.attr)) continue;
+			auto* sptr = (const uint8_t*) &spage;
+			vec.insert(vec.end(), sptr, sptr + sizeof(SerializedPage));
+			// page data
+			auto* pptr = it.second.data();
+			vec.insert(vec.end(), pptr, pptr + Page::size());
+			n_pages++;
+		}
+		return n_pages;
+	}
+	template <int W>
+	size_t Memory<W>::serialize_aligned_to(std::vector<uint8_t>& vec)
+	{
+		std::vector<SerializedPage> list;
+		list.reserve(this->m_pages.size());
+		vec.reserve(vec.size() + this->m_pages.size() * (sizeof(SerializedPage) + Page::size()));
+
+		for (const auto& it : this->m_pages)
+		{
+			SerializedPage spage { .addr = it.first, .attr = {} };
+			if (!serialized_page(it.second, spage.attr)) continue;
+			list.push_back(spage);
+			auto* pptr = it.second.data();
+			vec.insert(vec.end(), pptr, pptr + Page::size());
+		}
+		auto* lptr = (const uint8_t*) list.data();
+		vec.insert(vec.end(), lptr, lptr + list.size() * sizeof(SerializedPage));
+		return list.size();
+	}
+
+	static bool is_zero_page(const uint8_t* data)
+	{
+		uint64_t acc = 0;
+		for (size_t i = 0; i < Page::size(); i += sizeof(uint64_t)) {
+			uint64_t word;
+			std::memcpy(&word, &data[i], sizeof(word));
+			acc |= word;
+		}
+		return acc == 0;
+	}
+	static uint64_t page_hash(const uint8_t* data)
+	{
+		// four independent lanes, as one multiply chain is slow
+		uint64_t lane[4] = { 0xcbf29ce484222325, 1, 2, 3 };
+		for (size_t i = 0; i < Page::size(); i += 4 * sizeof(uint64_t)) {
+			for (int l = 0; l < 4; l++) {
+				uint64_t word;
+				std::memcpy(&word, &data[i + l * sizeof(uint64_t)], sizeof(word));
+				lane[l] = ((lane[l] << 5 | lane[l] >> 59) ^ word) * 0x9E3779B97F4A7C15;
+			}
+		}
+		return lane[0] ^ (lane[1] << 1 | lane[1] >> 63) ^ (lane[2] << 2 | lane[2] >> 62) ^ (lane[3] << 3 | lane[3] >> 61);
+	}
+
+	template <int W>
+	int64_t Memory<W>::binary_offset(address_t pageno) const
+	{
+		if (m_binary.size() < sizeof(Ehdr) || !validate_header<Ehdr> (elf_header()))
+			return -1;
+		const auto* elf = elf_header();
+		if (m_binary.size() < elf->e_phoff + elf->e_phnum * sizeof(Phdr))
+			return -1;
+		const auto* phdr = elf_offset<const Phdr> (elf->e_phoff);
+		const address_t addr = pageno << Page::SHIFT;
+		for (const auto* hdr = phdr; hdr < phdr + elf->e_phnum; hdr++)
+		{
+			if (hdr->p_type != PT_LOAD) continue;
+			// only whole pages of the file contents
+			if (addr >= hdr->p_vaddr && addr + Page::size() <= hdr->p_vaddr + hdr->p_filesz) {
+				const size_t offset = hdr->p_offset + (addr - hdr->p_vaddr);
+				if (offset + Page::size() <= m_binary.size())
+					return offset;
+			}
+		}
+		return -1;
+	}
+
+	template <int W>
+	void Memory<W>::serialize_compact_to(std::vector<uint8_t>& vec,
+		bool compress, SnapshotStats& stats)
+	{
+		// the first page seen with each hash
+		std::unordered_map<uint64_t, address_t> seen;
+		std::array<uint8_t, lz::max_size(Page::SIZE)> buffer;
+		seen.reserve(this->m_pages.size());
+
 		for (const auto& it : this->m_pages)
 		{
-			const auto& page = it.second;
-			assert(!page.attr.is_cow && "Should never have CoW pages stored");
-			// we want to ignore shared/non-owned pages
-			if (page.attr.non_owning) continue;
+			CompactPage cpage { .addr = it.first, .attr = {} };
+			if (!serialized_page(it.second, cpage.attr)) continue;
+			const auto* pdata = it.second.data();
+			const uint8_t* payload = nullptr;
+			stats.pages++;
+
+			if (is_zero_page(pdata)) {
+				cpage.kind = PAGE_ZERO;
+				stats.zero++;
+			} else if (const int64_t offset = binary_offset(it.first);
+				offset >= 0 && std::memcmp(&m_binary[offset], pdata, Page::size()) == 0) {
+				cpage.kind = PAGE_BINARY;
+				cpage.ref  = offset;
+				stats.binary++;
+			} else {
+				const auto [first, inserted] = seen.try_emplace(page_hash(pdata), it.first);
+				if (!inserted && std::memcmp(
+					find_page(first->second)->data(), pdata, Page::size()) == 0) {
+					cpage.kind = PAGE_DUPLICATE;
+					cpage.ref  = first->second;
+					stats.duplicate++;
+				} else {
+					cpage.kind = PAGE_RAW;
+					cpage.size = Page::size();
+					payload = pdata;
+					if (compress) {
+						const size_t len = lz::compress(pdata, Page::size(), buffer.data());
+						if (len < Page::size()) {
+							cpage.kind = PAGE_COMPRESSED;
+							cpage.size = len;
+							payload = buffer.data();
+							stats.compressed++;
+						}
+					}
+				}
+			}
+			auto* cptr = (const uint8_t*) &cpage;
+			vec.insert(vec.end(), cptr, cptr + sizeof(CompactPage));
+			if (payload != nullptr)
+				vec.insert(vec.end(), payload, payload + cpage.size);
+		}
+	}
+
+	template <int W>
+	size_t Memory<W>::serialize_delta_to(std::vector<uint8_t>& vec)
+	{
+		size_t n_pages = 0;
+		for (const address_t pageno : this->m_snapshot_dirty)
+		{
+			Page* page = this->find_page(pageno);
+			// pages can be listed twice, or be erased again
+			if (page == nullptr || !page->dirty) continue;
+			page->dirty = false;
+			if (page->attr.non_owning) continue;
 			const SerializedPage spage {
-				.addr = it.first,
-				.attr = page.attr
+				.addr = pageno,
+				.attr = page->attr
 			};
 			auto* sptr = (const uint8_t*) &spage;
 			vec.insert(vec.end(), sptr, sptr + sizeof(SerializedPage));
-			// page data
-			auto* pptr = page.data();
+			auto* pptr = page->data();
 			vec.insert(vec.end(), pptr, pptr + Page::size());
+			n_pages++;
 		}
+		m_snapshot_dirty.clear();
+		// the erased pages follow the page data, each once
+		std::sort(m_snapshot_erased.begin(), m_snapshot_erased.end());
+		m_snapshot_erased.erase(std::unique(m_snapshot_erased.begin(), m_snapshot_erased.end()),
+			m_snapshot_erased.end());
+		const uint64_t n_erased = m_snapshot_erased.size();
+		auto* cptr = (const uint8_t*) &n_erased;
+		vec.insert(vec.end(), cptr, cptr + sizeof(n_erased));
+		for (const address_t pageno : m_snapshot_erased) {
+			const uint64_t addr = pageno;
+			auto* aptr = (const uint8_t*) &addr;
+			vec.insert(vec.end(), aptr, aptr + sizeof(addr));
+		}
+		return n_pages;
 	}
 
+	// the list entry and data of page @p in a full snapshot
 	template <int W>
-	int Machine<W>::deserialize_from(const std::vector<uint8_t>& vec)
+	static std::pair<const SerializedPage*, const PageData*>
+	page_at(const uint8_t* base, const SerializedMachine<W>& state, size_t p)
+	{
+		if (state.flags & FLAG_ALIGNED) {
+			const size_t list = state.mem_offset + state.n_pages * Page::size();
+			return { (const SerializedPage*) &base[list + p * sizeof(SerializedPage)],
+				(const PageData*) &base[state.mem_offset + p * Page::size()] };
+		}
+		const size_t off = state.mem_offset + p * (sizeof(SerializedPage) + Page::size());
+		return { (const SerializedPage*) &base[off],
+			(const PageData*) &base[off + sizeof(SerializedPage)] };
+	}
+
+	template <int W>
+	static int validate_header(const uint8_t* data, size_t size)
 	{
-		if (vec.size() < sizeof(SerializedMachine<W>)) {
+		if (size < sizeof(SerializedMachine<W>)) {
 			return -1;
 		}
-		const auto& header = *(const SerializedMachine<W>*) vec.data();
-		if (header.magic != MAGiC_V4LUE)
+		const auto& header = *(const SerializedMachine<W>*) data;
+		if (header.magic != MAGiC_V4LUE || header.version != SNAPSHOT_VERSION)
 			return -1;
 		if (header.reg_size != sizeof(Registers<W>))
 			return -2;
@@ -97,11 +391,51 @@ namespace riscv
 			return -3;
 		if (header.attr_size != sizeof(PageAttributes))
 			return -4;
+		return 0;
+	}
+
+	template <int W>
+	int Machine<W>::deserialize_from(const std::vector<uint8_t>& vec)
+	{
+		if (int res = validate_header<W>(vec.data(), vec.size()); res != 0)
+			return res;
+		if (memory.has_linear_memory())
+			throw MachineException(ILLEGAL_OPERATION,
+				"Machines with linear memory can not be restored");
+		const auto& header = *(const SerializedMachine<W>*) vec.data();
+		// deltas only apply on top of the snapshot they were taken after,
+		// and not after the memory was changed since
+		if ((header.flags & FLAG_DELTA) &&
+			(header.parent_id != memory.snapshot_id() || memory.snapshot_diverged()))
+			return -5;
+		// compact snapshots restore pages from the binary
+		if ((header.flags & FLAG_COMPACT) && header.binary_hash != fnv1a_hash(memory.binary()))
+			return -7;
 		cpu.deserialize_from(vec, header);
 		memory.deserialize_from(vec, header);
 		return 0;
 	}
 	template <int W>
+	int Machine<W>::deserialize_mapped(const uint8_t* data, size_t size)
+	{
+		// the pages are used in place, so they have to be page-aligned
+		if ((uintptr_t) data % Page::size() != 0)
+			return -6;
+		if (int res = validate_header<W>(data, size); res != 0)
+			return res;
+		if (memory.has_linear_memory())
+			throw MachineException(ILLEGAL_OPERATION,
+				"Machines with linear memory can not be restored");
+		const auto& header = *(const SerializedMachine<W>*) data;
+		if (!(header.flags & FLAG_ALIGNED))
+			return -6;
+		if (size < header.mem_offset + header.n_pages * (Page::size() + sizeof(SerializedPage)))
+			return -1;
+		cpu.deserialize_from({}, header);
+		memory.deserialize_mapped(data, header);
+		return 0;
+	}
+	template <int W>
 	void CPU<W>::deserialize_from(const std::vector<uint8_t>& /* vec */,
 					const SerializedMachine<W>& state)
 	{
@@ -127,14 +461,113 @@ namespace riscv
 		this->m_stack_address = state.stack_address;
 		this->m_exit_address  = state.exit_address;
 
-		[[maybe_unused]]
+		if (state.flags & FLAG_COMPACT) {
+			this->deserialize_compact(vec, state);
+			return;
+		}
 		const size_t page_bytes =
 			state.n_pages * (sizeof(SerializedPage) + Page::size());
-		assert(vec.size() >= state.mem_offset + page_bytes);
+		if (vec.size() < state.mem_offset + page_bytes)
+			throw MachineException(ILLEGAL_OPERATION, "Truncated snapshot", vec.size());
+		if (state.flags & FLAG_DELTA) {
+			this->deserialize_delta(vec, state);
+			return;
+		}
+		this->deserialize_pages(vec.data(), state, false);
+	}
+	template <int W>
+	void Memory<W>::deserialize_compact(const std::vector<uint8_t>& vec,
+					const SerializedMachine<W>& state)
+	{
+		this->clear_all_pages();
+		this->restore_exec_pages();
+
+		size_t off = state.mem_offset;
+		for (size_t p = 0; p < state.n_pages; p++) {
+			if (off + sizeof(CompactPage) > vec.size())
+				throw MachineException(ILLEGAL_OPERATION, "Truncated snapshot", off);
+			CompactPage cpage;
+			std::memcpy(&cpage, &vec[off], sizeof(cpage));
+			off += sizeof(CompactPage);
+			if (cpage.size > vec.size() - off)
+				throw MachineException(ILLEGAL_OPERATION, "Truncated snapshot", off);
+			PageAttributes new_attr = cpage.attr;
+			new_attr.non_owning = false;
+			auto& page = allocate_page(cpage.addr, new_attr);
+			auto* pdata = page.page().buffer8.data();
+
+			switch (cpage.kind) {
+			case PAGE_ZERO:
+				break;
+			case PAGE_BINARY:
+				if (cpage.ref + Page::size() > m_binary.size())
+					throw MachineException(ILLEGAL_OPERATION,
+						"Snapshot refers outside of the binary", cpage.ref);
+				std::memcpy(pdata, &m_binary[cpage.ref], Page::size());
+				break;
+			case PAGE_DUPLICATE: {
+				const Page* first = find_page(cpage.ref);
+				if (first == nullptr || first == &page)
+					throw MachineException(ILLEGAL_OPERATION,
+						"Snapshot refers to a missing page", cpage.ref);
+				std::memcpy(pdata, first->data(), Page::size());
+				} break;
+			case PAGE_RAW:
+				if (cpage.size != Page::size())
+					throw MachineException(ILLEGAL_OPERATION, "Corrupt snapshot page", cpage.addr);
+				std::memcpy(pdata, &vec[off], Page::size());
+				break;
+			case PAGE_COMPRESSED:
+				if (!lz::decompress(&vec[off], cpage.size, pdata, Page::size()))
+					throw MachineException(ILLEGAL_OPERATION, "Corrupt snapshot page", cpage.addr);
+				break;
+			default:
+				throw MachineException(ILLEGAL_OPERATION, "Corrupt snapshot page", cpage.addr);
+			}
+			off += cpage.size;
+		}
+		this->set_snapshot_id(state.snapshot_id);
+	}
+	template <int W>
+	void Memory<W>::deserialize_mapped(const uint8_t* data,
+					const SerializedMachine<W>& state)
+	{
+		this->m_start_address = state.start_address;
+		this->m_stack_address = state.stack_address;
+		this->m_exit_address  = state.exit_address;
+
+		this->deserialize_pages(data, state, true);
+		this->m_mapped_begin = data + state.mem_offset;
+		this->m_mapped_end = m_mapped_begin + state.n_pages * Page::size();
+	}
+	template <int W>
+	void Memory<W>::deserialize_pages(const uint8_t* base,
+					const SerializedMachine<W>& state, bool mapped)
+	{
 		// completely reset the paging system as
 		// all pages will be completely replaced
 		this->clear_all_pages();
+		this->restore_exec_pages();
 
+		for (size_t p = 0; p < state.n_pages; p++) {
+			const auto [page, data] = page_at(base, state, p);
+			PageAttributes new_attr = page->attr;
+			if (mapped) {
+				// share the read-only data until the page is written to
+				new_attr.is_cow = true;
+				allocate_page(page->addr, new_attr, const_cast<PageData*> (data));
+			} else {
+				// when we serialized non-owning pages, we lost the connection
+				// so now we own the page data
+				new_attr.non_owning = false;
+				allocate_page(page->addr, new_attr, *data);
+			}
+		}
+		this->set_snapshot_id(state.snapshot_id);
+	}
+	template <int W>
+	void Memory<W>::restore_exec_pages()
+	{
 		if (m_exec_pagedata != nullptr && m_exec_pagedata_size > 0)
 		{
 			// NOTE: this only works if you restore to the same machine
@@ -144,20 +577,36 @@ namespace riscv
 					.read = true, .write = false, .exec = true
 				});
 		}
+	}
+	template <int W>
+	void Memory<W>::deserialize_delta(const std::vector<uint8_t>& vec,
+					const SerializedMachine<W>& state)
+	{
+		size_t off = state.mem_offset + state.n_pages * (sizeof(SerializedPage) + Page::size());
+		if (off + sizeof(uint64_t) > vec.size())
+			throw MachineException(ILLEGAL_OPERATION, "Truncated snapshot", off);
+		uint64_t n_erased;
+		std::memcpy(&n_erased, &vec[off], sizeof(n_erased));
+		off += sizeof(n_erased);
+		if (n_erased > (vec.size() - off) / sizeof(uint64_t))
+			throw MachineException(ILLEGAL_OPERATION, "Truncated snapshot", off);
+		for (size_t i = 0; i < n_erased; i++) {
+			uint64_t addr;
+			std::memcpy(&addr, &vec[off], sizeof(addr));
+			this->erase_page(addr);
+			off += sizeof(addr);
+		}
 
-		size_t off = state.mem_offset;
 		for (size_t p = 0; p < state.n_pages; p++) {
-			const auto& page = *(SerializedPage*) &vec[off];
-			off += sizeof(SerializedPage);
-			const auto& data = *(PageData*) &vec[off];
-			// when we serialized non-owning pages, we lost the connection
-			// so now we own the page data
-			PageAttributes new_attr = page.attr;
+			const auto [page, data] = page_at(vec.data(), state, p);
+			PageAttributes new_attr = page->attr;
 			new_attr.non_owning = false;
-			m_pages.try_emplace(page.addr, new_attr, data);
-
-			off += Page::size();
+			// replaces both owned and copy-on-write pages
+			m_pages.erase(page->addr);
+			m_page_table.erase(page->addr);
+			allocate_page(page->addr, new_attr, *data);
 		}
+		this->set_snapshot_id(state.snapshot_id);
 	}
 
 	template struct Machine<4>;
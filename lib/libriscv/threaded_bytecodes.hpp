@@ -0,0 +1,282 @@
+#pragma once
+#include "rv32i_instr.hpp"
+#include <iterator>
+
+namespace riscv
+{
+	// Bytecodes for the threaded dispatch engine. Each one is a label
+	// in CPU<W>::simulate_threaded, and the order must match its table.
+	enum threaded_bytecode : uint8_t
+	{
+		RV32I_BC_FUNCTION = 0, // call the regular instruction handler
+		RV32I_BC_LI,
+		RV32I_BC_ADDI,
+		RV32I_BC_OP_ADD,
+		RV32I_BC_OP_SUB,
+		RV32I_BC_LUI,
+		RV32I_BC_AUIPC,
+		RV32I_BC_LDB,
+		RV32I_BC_LDBU,
+		RV32I_BC_LDH,
+		RV32I_BC_LDHU,
+		RV32I_BC_LDW,
+		RV32I_BC_LDD,
+		RV32I_BC_STB,
+		RV32I_BC_STH,
+		RV32I_BC_STW,
+		RV32I_BC_STD,
+		RV32I_BC_BEQ,
+		RV32I_BC_BNE,
+		RV32I_BC_BLT,
+		RV32I_BC_BGE,
+		RV32I_BC_BLTU,
+		RV32I_BC_BGEU,
+		RV32I_BC_JAL,
+		RV32I_BC_JALR,
+		// fused instruction sequences
+		RV32I_BC_FUSED_LUI_ADDI,   // 32-bit constants
+		RV32I_BC_FUSED_AUIPC_ADDI, // PC-relative addresses
+		RV32I_BC_FUSED_AUIPC_JALR, // far calls
+		RV32I_BC_FUSED_AUIPC_LDW,  // PC-relative loads
+		RV32I_BC_FUSED_AUIPC_LDD,
+		RV32I_BC_FUSED_ADDI_BNE,   // counting loops
+		RV32I_BC_FUSED_ADDI_BEQ,
+		RV32I_BC_FUSED_RET,        // restore RA, pop stack, return
+		RV32I_BC_JIT,              // compiled block
+		RV32I_BC_AOT,              // block from an offline translation
+		RV32I_BC_MAX
+	};
+
+	inline const char* threaded_bytecode_name(const threaded_bytecode bc)
+	{
+		static constexpr const char* names[] = {
+			"FUNCTION", "LI", "ADDI", "OP_ADD", "OP_SUB", "LUI", "AUIPC",
+			"LDB", "LDBU", "LDH", "LDHU", "LDW", "LDD",
+			"STB", "STH", "STW", "STD",
+			"BEQ", "BNE", "BLT", "BGE", "BLTU", "BGEU", "JAL", "JALR",
+			"FUSED_LUI_ADDI", "FUSED_AUIPC_ADDI", "FUSED_AUIPC_JALR",
+			"FUSED_AUIPC_LDW", "FUSED_AUIPC_LDD", "FUSED_ADDI_BNE",
+			"FUSED_ADDI_BEQ", "FUSED_RET", "JIT", "AOT",
+		};
+		static_assert(std::size(names) == RV32I_BC_MAX,
+			"Every bytecode must have a name");
+		return (bc < RV32I_BC_MAX) ? names[bc] : "???";
+	}
+
+	// number of instructions executed by a bytecode
+	inline unsigned threaded_bytecode_length(const threaded_bytecode bc)
+	{
+		if (bc == RV32I_BC_FUSED_RET)
+			return 3;
+		if (bc >= RV32I_BC_FUSED_LUI_ADDI && bc < RV32I_BC_FUSED_RET)
+			return 2;
+		return 1;
+	}
+
+	// Pre-decoded operands, replacing the raw instruction bits of the
+	// slot for bytecodes that are implemented by the dispatch loop.
+	// I-type uses @reg as rd, while S-type and B-type use it as rs2.
+	union FasterItype
+	{
+		uint32_t whole;
+		struct {
+			uint8_t reg;
+			uint8_t rs1;
+			int16_t imm;
+		};
+	};
+	union FasterOpType
+	{
+		uint32_t whole;
+		struct {
+			uint8_t rd;
+			uint8_t rs1;
+			uint8_t rs2;
+			uint8_t unused;
+		};
+	};
+	union FasterJtype
+	{
+		uint32_t whole;
+		struct {
+			uint32_t rd     : 8;
+			int32_t  offset : 24;
+		};
+	};
+	static_assert(sizeof(FasterItype) == 4 && sizeof(FasterOpType) == 4
+		&& sizeof(FasterJtype) == 4,
+		"Pre-decoded operands must fit in an instruction");
+
+	// Select the bytecode for an instruction. Anything that is not
+	// handled directly by the dispatch loop, including instructions
+	// that have no effect (rd == 0), goes through RV32I_BC_FUNCTION.
+	template <int W>
+	inline threaded_bytecode threaded_bytecode_for(const rv32i_instruction instr)
+	{
+		if (!instr.is_long())
+			return RV32I_BC_FUNCTION;
+
+		switch (instr.opcode()) {
+		case 0b0010011: // OP_IMM
+			if (instr.Itype.rd != 0 && instr.Itype.funct3 == 0x0)
+				return (instr.Itype.rs1 == 0) ? RV32I_BC_LI : RV32I_BC_ADDI;
+			break;
+		case 0b0110011: // OP
+			if (instr.Rtype.rd != 0 && instr.Rtype.jumptable_friendly_op() == 0x0)
+				return (instr.Rtype.is_f7()) ? RV32I_BC_OP_SUB : RV32I_BC_OP_ADD;
+			break;
+		case 0b0110111: // LUI
+			if (instr.Utype.rd != 0)
+				return RV32I_BC_LUI;
+			break;
+		case 0b0010111: // AUIPC
+			if (instr.Utype.rd != 0)
+				return RV32I_BC_AUIPC;
+			break;
+		case 0b0000011: // LOAD
+			if (instr.Itype.rd == 0)
+				break;
+			switch (instr.Itype.funct3) {
+			case 0x0: return RV32I_BC_LDB;
+			case 0x1: return RV32I_BC_LDH;
+			case 0x2: return RV32I_BC_LDW;
+			case 0x3: if (W == 8) return RV32I_BC_LDD; break;
+			case 0x4: return RV32I_BC_LDBU;
+			case 0x5: return RV32I_BC_LDHU;
+			}
+			break;
+		case 0b0100011: // STORE
+			switch (instr.Stype.funct3) {
+			case 0x0: return RV32I_BC_STB;
+			case 0x1: return RV32I_BC_STH;
+			case 0x2: return RV32I_BC_STW;
+			case 0x3: if (W == 8) return RV32I_BC_STD; break;
+			}
+			break;
+		case 0b1100011: // BRANCH
+			switch (instr.Btype.funct3) {
+			case 0x0: return RV32I_BC_BEQ;
+			case 0x1: return RV32I_BC_BNE;
+			case 0x4: return RV32I_BC_BLT;
+			case 0x5: return RV32I_BC_BGE;
+			case 0x6: return RV32I_BC_BLTU;
+			case 0x7: return RV32I_BC_BGEU;
+			}
+			break;
+		case 0b1101111: // JAL
+			return RV32I_BC_JAL;
+		case 0b1100111: // JALR
+			return RV32I_BC_JALR;
+		}
+		return RV32I_BC_FUNCTION;
+	}
+
+	// Select a fused bytecode for the sequence of 4-byte instructions
+	// starting with @bc[0], given the unfused bytecodes of up to @count
+	// consecutive slots. The operand layouts are left as they are, and
+	// the fused handlers execute the instructions in order, so there
+	// are no register dependency requirements.
+	template <int W>
+	inline threaded_bytecode threaded_fused_bytecode_for(
+		const threaded_bytecode* bc, const size_t count)
+	{
+		if (count >= 2) {
+			switch (bc[0]) {
+			case RV32I_BC_LUI:
+				if (bc[1] == RV32I_BC_ADDI)
+					return RV32I_BC_FUSED_LUI_ADDI;
+				break;
+			case RV32I_BC_AUIPC:
+				switch (bc[1]) {
+				case RV32I_BC_ADDI: return RV32I_BC_FUSED_AUIPC_ADDI;
+				case RV32I_BC_JALR: return RV32I_BC_FUSED_AUIPC_JALR;
+				case RV32I_BC_LDW:  return RV32I_BC_FUSED_AUIPC_LDW;
+				case RV32I_BC_LDD:  return RV32I_BC_FUSED_AUIPC_LDD;
+				default: break;
+				}
+				break;
+			case RV32I_BC_ADDI:
+				if (bc[1] == RV32I_BC_BNE)
+					return RV32I_BC_FUSED_ADDI_BNE;
+				if (bc[1] == RV32I_BC_BEQ)
+					return RV32I_BC_FUSED_ADDI_BEQ;
+				break;
+			case RV32I_BC_LDW:
+			case RV32I_BC_LDD:
+				// LW is the register-sized load only on RV32
+				if (count >= 3 && bc[0] == (W == 4 ? RV32I_BC_LDW : RV32I_BC_LDD)
+					&& bc[1] == RV32I_BC_ADDI && bc[2] == RV32I_BC_JALR)
+					return RV32I_BC_FUSED_RET;
+				break;
+			default:
+				break;
+			}
+		}
+		return bc[0];
+	}
+
+	// Rewrite the instruction into the operand layout its bytecode
+	// expects, moving the field extraction out of the dispatch loop.
+	inline rv32i_instruction threaded_rewrite(
+		const threaded_bytecode bytecode, const rv32i_instruction instr)
+	{
+		switch (bytecode) {
+		case RV32I_BC_LI:
+		case RV32I_BC_ADDI:
+		case RV32I_BC_LDB:
+		case RV32I_BC_LDBU:
+		case RV32I_BC_LDH:
+		case RV32I_BC_LDHU:
+		case RV32I_BC_LDW:
+		case RV32I_BC_LDD:
+		case RV32I_BC_JALR: {
+			FasterItype rewritten;
+			rewritten.reg = instr.Itype.rd;
+			rewritten.rs1 = instr.Itype.rs1;
+			rewritten.imm = instr.Itype.signed_imm();
+			return rewritten.whole;
+			}
+		case RV32I_BC_STB:
+		case RV32I_BC_STH:
+		case RV32I_BC_STW:
+		case RV32I_BC_STD: {
+			FasterItype rewritten;
+			rewritten.reg = instr.Stype.rs2;
+			rewritten.rs1 = instr.Stype.rs1;
+			rewritten.imm = instr.Stype.signed_imm();
+			return rewritten.whole;
+			}
+		case RV32I_BC_BEQ:
+		case RV32I_BC_BNE:
+		case RV32I_BC_BLT:
+		case RV32I_BC_BGE:
+		case RV32I_BC_BLTU:
+		case RV32I_BC_BGEU: {
+			FasterItype rewritten;
+			rewritten.reg = instr.Btype.rs2;
+			rewritten.rs1 = instr.Btype.rs1;
+			rewritten.imm = instr.Btype.signed_imm();
+			return rewritten.whole;
+			}
+		case RV32I_BC_OP_ADD:
+		case RV32I_BC_OP_SUB: {
+			FasterOpType rewritten;
+			rewritten.rd  = instr.Rtype.rd;
+			rewritten.rs1 = instr.Rtype.rs1;
+			rewritten.rs2 = instr.Rtype.rs2;
+			rewritten.unused = 0;
+			return rewritten.whole;
+			}
+		case RV32I_BC_JAL: {
+			FasterJtype rewritten;
+			rewritten.rd = instr.Jtype.rd;
+			rewritten.offset = instr.Jtype.jump_offset();
+			return rewritten.whole;
+			}
+		default:
+			// LUI and AUIPC have wide immediates and keep the raw
+			// format, as does everything that calls a regular handler
+			return instr;
+		}
+	}
+}
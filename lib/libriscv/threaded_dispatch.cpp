@@ -0,0 +1,391 @@
+#include "machine.hpp"
+#include "decoder_cache.hpp"
+#include "threaded_bytecodes.hpp"
+#ifdef RISCV_JIT
+#include "jit.hpp"
+#endif
+#ifdef RISCV_AOT
+#include "aot.hpp"
+#endif
+
+namespace riscv
+{
+#ifdef RISCV_THREADED_DISPATCH
+	template <int W>
+	void CPU<W>::simulate_threaded(const uint64_t max_counter)
+	{
+#ifndef RISCV_DEBUG
+		// one label per bytecode, in the same order as the enum
+		static void* dispatch_table[] = {
+			&&rv32i_function,
+			&&rv32i_li,
+			&&rv32i_addi,
+			&&rv32i_op_add,
+			&&rv32i_op_sub,
+			&&rv32i_lui,
+			&&rv32i_auipc,
+			&&rv32i_ldb,
+			&&rv32i_ldbu,
+			&&rv32i_ldh,
+			&&rv32i_ldhu,
+			&&rv32i_ldw,
+			&&rv32i_ldd,
+			&&rv32i_stb,
+			&&rv32i_sth,
+			&&rv32i_stw,
+			&&rv32i_std,
+			&&rv32i_beq,
+			&&rv32i_bne,
+			&&rv32i_blt,
+			&&rv32i_bge,
+			&&rv32i_bltu,
+			&&rv32i_bgeu,
+			&&rv32i_jal,
+			&&rv32i_jalr,
+			&&rv32i_fused_lui_addi,
+			&&rv32i_fused_auipc_addi,
+			&&rv32i_fused_auipc_jalr,
+			&&rv32i_fused_auipc_ldw,
+			&&rv32i_fused_auipc_ldd,
+			&&rv32i_fused_addi_bne,
+			&&rv32i_fused_addi_beq,
+			&&rv32i_fused_ret,
+			&&rv32i_jit,
+			&&rv32i_aot,
+		};
+		static_assert(std::size(dispatch_table) == RV32I_BC_MAX,
+			"Dispatch table must cover every bytecode");
+
+		using saddr_t = std::make_signed_t<address_t>;
+		constexpr size_t DIVISOR = DecoderCache<Page::SIZE>::DIVISOR;
+
+		// code outside of the execute segment has no decoder cache
+		if (UNLIKELY(!(this->pc() >= m_exec_begin && this->pc() < m_exec_end))) {
+			this->simulate();
+			return;
+		}
+		DecoderData<W>* const decoder = machine().memory.get_decoder_cache();
+		DecoderData<W>* entry = &decoder[this->pc() / DIVISOR];
+		// the counter lives in a register until we leave the loop
+		uint64_t counter = m_counter;
+#ifdef RISCV_JIT
+		JIT<W>* const jit = machine().memory.jit();
+		// only the machine that owns the decoder cache compiles blocks
+		JIT<W>* const jit_compiler =
+			(machine().memory.is_forked()) ? nullptr : jit;
+		JITContext<W> jit_ctx { machine().memory };
+#endif
+#ifdef RISCV_AOT
+		const AOT<W>* const aot = machine().memory.aot();
+		// translated blocks update m_counter directly
+		AOTState<W> aot_state {
+			&this->reg(0), &registers().pc, &m_counter, max_counter,
+			&machine().memory, &AOT<W>::callbacks
+		};
+#endif
+
+// regular 4-byte instruction, continue with the next slot
+#define NEXT_CHECKED()                                 \
+		registers().pc += 4;                           \
+		entry += 4 / DIVISOR;                          \
+		if (UNLIKELY(++counter >= max_counter))        \
+			goto exit_dispatch;                        \
+		goto *dispatch_table[entry->bytecode];
+#ifdef RISCV_BATCHED_BUDGET
+// the budget is only checked at the end of each block, which
+// overshoots the limit by less than the longest basic block
+#define NEXT_INSTR()                                   \
+		registers().pc += 4;                           \
+		entry += 4 / DIVISOR;                          \
+		counter ++;                                    \
+		goto *dispatch_table[entry->bytecode];
+#else
+#define NEXT_INSTR() NEXT_CHECKED()
+#endif
+// PC has been modified, look up the new slot
+#define NEXT_BLOCK()                                   \
+		if (UNLIKELY(++counter >= max_counter))        \
+			goto exit_dispatch;                        \
+		goto check_jump;
+#define INSTR() const rv32i_instruction instr = entry->instr
+#ifdef RISCV_JIT
+#define JIT_HOT_CHECK()                                \
+		if (jit_compiler != nullptr && UNLIKELY(jit_compiler->hot(this->pc()))) \
+			jit_compiler->compile(*this, this->pc(), *entry);
+#else
+#define JIT_HOT_CHECK() /* */
+#endif
+// taken branch or JAL, with a target that was validated when the
+// decoder cache was generated, so check_jump can be skipped
+#define DIRECT_JUMP(offset)                            \
+		registers().pc += offset;                      \
+		entry += offset / (int) DIVISOR;               \
+		if (UNLIKELY(++counter >= max_counter))        \
+			goto exit_dispatch;                        \
+		JIT_HOT_CHECK();                               \
+		goto *dispatch_table[entry->bytecode];
+// move to the next instruction of a fused sequence, without dispatch
+#define SKIP_INSTR()                                   \
+		registers().pc += 4;                           \
+		entry += 4 / DIVISOR;                          \
+		counter ++;
+// fused sequences must not go past the instruction limit, so when
+// there is not enough budget left, execute only the first instruction
+#ifdef RISCV_BATCHED_BUDGET
+#define FUSED_BUDGET(n, label) /* */
+#else
+#define FUSED_BUDGET(n, label)                         \
+		if (UNLIKELY(counter + n > max_counter))       \
+			goto label;
+#endif
+
+		try {
+		goto *dispatch_table[entry->bytecode];
+
+rv32i_li: {
+		const FasterItype fi { entry->instr.whole };
+		this->reg(fi.reg) = fi.imm;
+		NEXT_INSTR();
+	}
+rv32i_addi: {
+		const FasterItype fi { entry->instr.whole };
+		this->reg(fi.reg) = this->reg(fi.rs1) + fi.imm;
+		NEXT_INSTR();
+	}
+rv32i_op_add: {
+		const FasterOpType fop { entry->instr.whole };
+		this->reg(fop.rd) = this->reg(fop.rs1) + this->reg(fop.rs2);
+		NEXT_INSTR();
+	}
+rv32i_op_sub: {
+		const FasterOpType fop { entry->instr.whole };
+		this->reg(fop.rd) = this->reg(fop.rs1) - this->reg(fop.rs2);
+		NEXT_INSTR();
+	}
+rv32i_lui: {
+		INSTR();
+		this->reg(instr.Utype.rd) = (int32_t) instr.Utype.upper_imm();
+		NEXT_INSTR();
+	}
+rv32i_auipc: {
+		INSTR();
+		this->reg(instr.Utype.rd) = this->pc() + instr.Utype.upper_imm();
+		NEXT_INSTR();
+	}
+
+#define LOAD_INSTR(type, cast)                                         \
+	{                                                                  \
+		const FasterItype fi { entry->instr.whole };                   \
+		const address_t addr = this->reg(fi.rs1) + fi.imm;             \
+		this->reg(fi.reg) =                                            \
+			cast machine().memory.template read<type> (addr);          \
+		NEXT_INSTR();                                                  \
+	}
+rv32i_ldb:  LOAD_INSTR(uint8_t,  (saddr_t) (int8_t));
+rv32i_ldbu: LOAD_INSTR(uint8_t,  );
+rv32i_ldh:  LOAD_INSTR(uint16_t, (saddr_t) (int16_t));
+rv32i_ldhu: LOAD_INSTR(uint16_t, );
+rv32i_ldw:  LOAD_INSTR(uint32_t, (saddr_t) (int32_t));
+rv32i_ldd:  LOAD_INSTR(uint64_t, );
+
+#define STORE_INSTR(type)                                              \
+	{                                                                  \
+		const FasterItype fi { entry->instr.whole };                   \
+		const address_t addr = this->reg(fi.rs1) + fi.imm;             \
+		machine().memory.template write<type> (addr, this->reg(fi.reg)); \
+		NEXT_INSTR();                                                  \
+	}
+rv32i_stb: STORE_INSTR(uint8_t);
+rv32i_sth: STORE_INSTR(uint16_t);
+rv32i_stw: STORE_INSTR(uint32_t);
+rv32i_std: STORE_INSTR(uint64_t);
+
+#define BRANCH_INSTR(cast, op)                                         \
+	{                                                                  \
+		const FasterItype fi { entry->instr.whole };                   \
+		if (cast this->reg(fi.rs1) op cast this->reg(fi.reg)) {        \
+			DIRECT_JUMP(fi.imm);                                       \
+		}                                                              \
+		NEXT_CHECKED();                                                \
+	}
+rv32i_beq:  BRANCH_INSTR(, ==);
+rv32i_bne:  BRANCH_INSTR(, !=);
+rv32i_blt:  BRANCH_INSTR((saddr_t), <);
+rv32i_bge:  BRANCH_INSTR((saddr_t), >=);
+rv32i_bltu: BRANCH_INSTR(, <);
+rv32i_bgeu: BRANCH_INSTR(, >=);
+
+rv32i_jal: {
+		const FasterJtype fj { entry->instr.whole };
+		if (fj.rd != 0) {
+			this->reg(fj.rd) = this->pc() + 4;
+		}
+		DIRECT_JUMP(fj.offset);
+	}
+rv32i_jalr: {
+		const FasterItype fi { entry->instr.whole };
+		const address_t address = this->reg(fi.rs1) + fi.imm;
+		if (fi.reg != 0) {
+			this->reg(fi.reg) = this->pc() + 4;
+		}
+		// fault with the same PC as the JALR handler
+		this->jump(address - 4);
+		registers().pc += 4;
+		NEXT_BLOCK();
+	}
+
+rv32i_fused_lui_addi: {
+		FUSED_BUDGET(2, rv32i_lui);
+		INSTR();
+		this->reg(instr.Utype.rd) = (int32_t) instr.Utype.upper_imm();
+		SKIP_INSTR();
+		goto rv32i_addi;
+	}
+#define FUSED_AUIPC(label)                                             \
+	{                                                                  \
+		FUSED_BUDGET(2, rv32i_auipc);                                  \
+		INSTR();                                                       \
+		this->reg(instr.Utype.rd) = this->pc() + instr.Utype.upper_imm(); \
+		SKIP_INSTR();                                                  \
+		goto label;                                                    \
+	}
+rv32i_fused_auipc_addi: FUSED_AUIPC(rv32i_addi);
+rv32i_fused_auipc_jalr: FUSED_AUIPC(rv32i_jalr);
+rv32i_fused_auipc_ldw:  FUSED_AUIPC(rv32i_ldw);
+rv32i_fused_auipc_ldd:  FUSED_AUIPC(rv32i_ldd);
+
+#define FUSED_ADDI(label)                                              \
+	{                                                                  \
+		FUSED_BUDGET(2, rv32i_addi);                                   \
+		const FasterItype fi { entry->instr.whole };                   \
+		this->reg(fi.reg) = this->reg(fi.rs1) + fi.imm;                \
+		SKIP_INSTR();                                                  \
+		goto label;                                                    \
+	}
+rv32i_fused_addi_bne: FUSED_ADDI(rv32i_bne);
+rv32i_fused_addi_beq: FUSED_ADDI(rv32i_beq);
+
+rv32i_fused_ret: {
+		// LW/LD ra, imm(sp); ADDI sp, sp, imm; JALR ra
+		if constexpr (W == 4) {
+			FUSED_BUDGET(3, rv32i_ldw);
+		} else {
+			FUSED_BUDGET(3, rv32i_ldd);
+		}
+		{
+			const FasterItype fi { entry->instr.whole };
+			const address_t addr = this->reg(fi.rs1) + fi.imm;
+			this->reg(fi.reg) = machine().memory.template read<address_t> (addr);
+		}
+		SKIP_INSTR();
+		{
+			const FasterItype fi { entry->instr.whole };
+			this->reg(fi.reg) = this->reg(fi.rs1) + fi.imm;
+		}
+		SKIP_INSTR();
+		goto rv32i_jalr;
+	}
+
+rv32i_jit: {
+#ifdef RISCV_JIT
+		const auto& block = jit->block(this->pc());
+		if (LIKELY(counter + block.length <= max_counter)) {
+			const uint64_t executed =
+				block.func(&this->reg(0), &jit_ctx, max_counter - counter);
+			if (UNLIKELY(jit_ctx.faulted)) {
+				counter += executed;
+				jit_ctx.faulted = 0;
+				std::rethrow_exception(std::move(jit_ctx.exception));
+			}
+			// the first instruction was left to the interpreter,
+			// eg. a misaligned jump, which would otherwise loop forever
+			if (UNLIKELY(executed == 0))
+				goto *dispatch_table[block.bytecode];
+			counter += executed;
+			if (UNLIKELY(counter >= max_counter))
+				goto exit_dispatch;
+			goto check_jump;
+		}
+		// not enough budget for the whole block
+		goto *dispatch_table[block.bytecode];
+#else
+		goto rv32i_function;
+#endif
+	}
+
+rv32i_aot: {
+#ifdef RISCV_AOT
+		const auto& block = aot->block(this->pc());
+		if (LIKELY(counter + block.length <= max_counter)) {
+			m_counter = counter;
+			try {
+				block.func(aot_state);
+			} catch (...) {
+				counter = m_counter;
+				throw;
+			}
+			// the first instruction was left to the interpreter
+			if (UNLIKELY(m_counter == counter))
+				goto *dispatch_table[block.bytecode];
+			counter = m_counter;
+			if (UNLIKELY(counter >= max_counter))
+				goto exit_dispatch;
+			goto check_jump;
+		}
+		// not enough budget for the whole block
+		goto *dispatch_table[block.bytecode];
+#else
+		goto rv32i_function;
+#endif
+	}
+
+rv32i_function: {
+		// the handler may read or modify the counter, eg. system calls
+		m_counter = counter;
+		entry->handler(*this, entry->instr);
+		counter = m_counter;
+		registers().pc += entry->instr.length();
+		if (UNLIKELY(machine().stopped())) {
+			counter ++;
+			goto exit_dispatch;
+		}
+		NEXT_BLOCK();
+	}
+
+check_jump:
+		if (LIKELY(this->pc() >= m_exec_begin && this->pc() < m_exec_end)) {
+			entry = &decoder[this->pc() / DIVISOR];
+			JIT_HOT_CHECK();
+			goto *dispatch_table[entry->bytecode];
+		}
+		// leaving the execute segment, let the caller single-step
+
+exit_dispatch:
+		m_counter = counter;
+		} catch (...) {
+			m_counter = counter;
+			throw;
+		}
+#undef INSTR
+#undef NEXT_INSTR
+#undef NEXT_CHECKED
+#undef JIT_HOT_CHECK
+#undef DIRECT_JUMP
+#undef NEXT_BLOCK
+#undef SKIP_INSTR
+#undef FUSED_BUDGET
+#undef FUSED_AUIPC
+#undef FUSED_ADDI
+#undef LOAD_INSTR
+#undef STORE_INSTR
+#undef BRANCH_INSTR
+#else
+		(void) max_counter;
+		this->simulate();
+#endif
+	}
+
+	template void CPU<4>::simulate_threaded(uint64_t);
+	template void CPU<8>::simulate_threaded(uint64_t);
+#endif
+}
@@ -1,6 +1,12 @@
 #pragma once
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <string>
+#include <vector>
+#include <sys/uio.h>
+#include <EASTL/fixed_vector.h>
 
 /**
  * Container that is designed to hold pointers to guest data, which can
@@ -11,31 +17,41 @@ namespace riscv
 {
 	struct Buffer
 	{
-		bool    is_sequential() const noexcept { return m_idx == 1; }
-		const auto& first() const { return m_data[0]; }
+		bool    is_sequential() const noexcept { return m_data.size() == 1; }
+		const auto& first() const { return m_data.empty() ? empty_entry : m_data[0]; }
 		const char* c_str() const noexcept { return first().first; }
 		size_t      size() const noexcept { return m_len; }
+		size_t      segments() const noexcept { return m_data.size(); }
 
-		size_t copy_to(char* dst, size_t dstlen);
-		void   foreach(std::function<void(const char*, size_t)> cb);
+		size_t copy_to(char* dst, size_t dstlen) const;
+		void   foreach(std::function<void(const char*, size_t)> cb) const;
 		std::string to_string() const;
 		char* to_buffer(char* dest) const;
 		char* to_buffer() const;
+		// the segments as host iovecs, eg. for writev and sendmsg
+		std::vector<struct iovec> to_iovec() const;
+
+		// 64-bit FNV-1a hash of the contents
+		uint64_t hash() const noexcept;
+		// compare the contents with @len bytes at @data, like memcmp
+		int compare(const char* data, size_t len) const noexcept;
+		bool operator== (const Buffer& other) const noexcept;
 
 		Buffer() = default;
 		void append_page(const char* data, size_t len);
 
 	private:
-		std::array<std::pair<const char*, size_t>, 4> m_data = {};
-		uint32_t m_len  = 0; /* Total length */
-		uint32_t m_idx  = 0; /* Current array index */
+		using entry_t = std::pair<const char*, size_t>;
+		static inline const entry_t empty_entry {nullptr, 0};
+		// the common case of a few pages is stored inline
+		eastl::fixed_vector<entry_t, 4> m_data;
+		size_t m_len = 0; /* Total length */
 	};
 
-	inline size_t Buffer::copy_to(char* dst, size_t maxlen)
+	inline size_t Buffer::copy_to(char* dst, size_t maxlen) const
 	{
 		size_t len = 0;
 		for (const auto& entry : m_data) {
-			if (entry.second == 0) break;
 			if (UNLIKELY(len + entry.second > maxlen)) break;
 			std::copy(entry.first, entry.first + entry.second, &dst[len]);
 			len += entry.second;
@@ -43,28 +59,30 @@ namespace riscv
 		return len;
 	}
 
-	inline void Buffer::foreach(std::function<void(const char*, size_t)> cb)
+	inline void Buffer::foreach(std::function<void(const char*, size_t)> cb) const
 	{
 		for (const auto& entry : m_data) {
-			if (entry.second == 0) break;
 			cb(entry.first, entry.second);
 		}
 	}
 
 	inline void Buffer::append_page(const char* buffer, size_t len)
 	{
-		assert(len <= Page::size());
-		assert(m_idx < m_data.size());
+		if (len == 0) return;
 		m_len += len;
-		m_data.at(m_idx ++) = {buffer, len};
+		// extend the last segment when the memory is contiguous
+		if (!m_data.empty() && m_data.back().first + m_data.back().second == buffer) {
+			m_data.back().second += len;
+			return;
+		}
+		m_data.push_back({buffer, len});
 	}
 
 	inline std::string Buffer::to_string() const
 	{
 		std::string result;
 		result.reserve(this->m_len);
-		for (size_t i = 0; i < m_idx; i++) {
-			auto& entry = m_data[i];
+		for (const auto& entry : m_data) {
 			result.append(entry.first, entry.first + entry.second);
 		}
 		return result;
@@ -73,8 +91,7 @@ namespace riscv
 	inline char* Buffer::to_buffer(char* buffer) const
 	{
 		char* dest = buffer;
-		for (size_t i = 0; i < m_idx; i++) {
-			auto& entry = m_data[i];
+		for (const auto& entry : m_data) {
 			std::copy(entry.first, entry.first + entry.second, dest);
 			dest += entry.second;
 		}
@@ -84,4 +101,61 @@ namespace riscv
 	{
 		return to_buffer(new char[this->m_len]);
 	}
+
+	inline std::vector<struct iovec> Buffer::to_iovec() const
+	{
+		std::vector<struct iovec> result;
+		result.reserve(m_data.size());
+		for (const auto& entry : m_data) {
+			result.push_back({ (void*) entry.first, entry.second });
+		}
+		return result;
+	}
+
+	inline uint64_t Buffer::hash() const noexcept
+	{
+		uint64_t hash = 0xcbf29ce484222325;
+		for (const auto& entry : m_data) {
+			for (size_t i = 0; i < entry.second; i++) {
+				hash = (hash ^ (uint8_t) entry.first[i]) * 0x100000001b3;
+			}
+		}
+		return hash;
+	}
+
+	inline int Buffer::compare(const char* data, size_t len) const noexcept
+	{
+		for (const auto& entry : m_data) {
+			const size_t n = std::min(entry.second, len);
+			if (const int res = std::memcmp(entry.first, data, n); res != 0)
+				return res;
+			if (n < entry.second)
+				return 1; // this buffer is longer
+			data += n;
+			len  -= n;
+		}
+		return (len == 0) ? 0 : -1;
+	}
+
+	inline bool Buffer::operator== (const Buffer& other) const noexcept
+	{
+		if (this->m_len != other.m_len)
+			return false;
+		// walk the segments of both buffers at the same time
+		size_t i = 0, ioff = 0;
+		size_t j = 0, joff = 0;
+		while (i < m_data.size() && j < other.m_data.size())
+		{
+			const auto& a = m_data[i];
+			const auto& b = other.m_data[j];
+			const size_t n = std::min(a.second - ioff, b.second - joff);
+			if (std::memcmp(a.first + ioff, b.first + joff, n) != 0)
+				return false;
+			ioff += n;
+			joff += n;
+			if (ioff == a.second) { i++; ioff = 0; }
+			if (joff == b.second) { j++; joff = 0; }
+		}
+		return true;
+	}
 }
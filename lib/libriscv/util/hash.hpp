@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+namespace riscv
+{
+	// 64-bit FNV-1a, used to identify a binary
+	inline uint64_t fnv1a_hash(std::string_view data) noexcept
+	{
+		uint64_t hash = 0xcbf29ce484222325;
+		for (const char c : data) {
+			hash ^= (uint8_t) c;
+			hash *= 0x100000001b3;
+		}
+		return hash;
+	}
+}
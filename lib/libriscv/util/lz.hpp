@@ -0,0 +1,142 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * A small LZ77 block compressor in the style of LZ4, for snapshot pages.
+ * A block is a list of sequences: a token with the literal length in the
+ * high nibble and the match length (minus 4) in the low nibble, extended
+ * with 255-bytes when 15, then the literals, then a 16-bit match offset.
+ * The last sequence only has literals.
+**/
+
+namespace riscv::lz
+{
+	static constexpr size_t MIN_MATCH = 4;
+
+	// the largest compressed size of @len bytes
+	inline constexpr size_t max_size(size_t len) noexcept {
+		return len + len / 255 + 16;
+	}
+
+	inline uint8_t* write_length(uint8_t* op, size_t len)
+	{
+		for (; len >= 255; len -= 255)
+			*op++ = 255;
+		*op++ = len;
+		return op;
+	}
+
+	inline uint8_t* write_sequence(uint8_t* op, const uint8_t* lit, size_t nlit,
+		size_t offset, size_t mlen)
+	{
+		const size_t mcode = (mlen != 0) ? mlen - MIN_MATCH : 0;
+		uint8_t* token = op++;
+		*token = ((nlit < 15) ? nlit : 15) << 4;
+		if (nlit >= 15)
+			op = write_length(op, nlit - 15);
+		if (nlit != 0)
+			std::memcpy(op, lit, nlit);
+		op += nlit;
+		if (mlen == 0)
+			return op;
+		*token |= (mcode < 15) ? mcode : 15;
+		*op++ = offset & 0xFF;
+		*op++ = offset >> 8;
+		if (mcode >= 15)
+			op = write_length(op, mcode - 15);
+		return op;
+	}
+
+	// compresses @len bytes into @dst, which must hold max_size(len) bytes,
+	// and returns the compressed size
+	inline size_t compress(const uint8_t* src, size_t len, uint8_t* dst)
+	{
+		static constexpr int HASH_BITS = 12;
+		uint32_t table[1u << HASH_BITS] = {};
+		uint8_t* op = dst;
+		size_t ip = 0, anchor = 0;
+		// the matches start at least 8 bytes before the end
+		const size_t limit = (len > 8 + MIN_MATCH) ? len - 8 - MIN_MATCH : 0;
+		while (ip < limit)
+		{
+			uint32_t seq;
+			std::memcpy(&seq, &src[ip], sizeof(seq));
+			const uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+			const size_t ref = table[h];
+			table[h] = ip;
+			uint32_t rseq;
+			std::memcpy(&rseq, &src[ref], sizeof(rseq));
+			if (ref >= ip || ip - ref > 0xFFFF || rseq != seq) {
+				// skip ahead faster through data that doesn't compress
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+			size_t mlen = MIN_MATCH;
+			while (ip + mlen < len && src[ref + mlen] == src[ip + mlen])
+				mlen++;
+			op = write_sequence(op, &src[anchor], ip - anchor, ip - ref, mlen);
+			ip += mlen;
+			anchor = ip;
+		}
+		op = write_sequence(op, &src[anchor], len - anchor, 0, 0);
+		return op - dst;
+	}
+
+	// decompresses @srclen bytes into exactly @dstlen bytes at @dst,
+	// returning false when the data is corrupt
+	inline bool decompress(const uint8_t* src, size_t srclen, uint8_t* dst, size_t dstlen)
+	{
+		const uint8_t* ip = src;
+		const uint8_t* iend = src + srclen;
+		uint8_t* op = dst;
+		uint8_t* oend = dst + dstlen;
+		auto read_length = [&] (size_t len) -> size_t {
+			if (len != 15) return len;
+			uint8_t b;
+			do {
+				if (ip >= iend) return SIZE_MAX;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+			return len;
+		};
+		// the data ends with a sequence of only literals
+		while (true)
+		{
+			if (ip >= iend)
+				return false;
+			const uint8_t token = *ip++;
+			const size_t nlit = read_length(token >> 4);
+			if (nlit > size_t(iend - ip) || nlit > size_t(oend - op))
+				return false;
+			if (nlit != 0)
+				std::memcpy(op, ip, nlit);
+			ip += nlit;
+			op += nlit;
+			if (ip == iend)
+				break;
+			if (iend - ip < 2)
+				return false;
+			const size_t offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			size_t mlen = read_length(token & 0xF);
+			if (mlen == SIZE_MAX)
+				return false;
+			mlen += MIN_MATCH;
+			if (offset == 0 || offset > size_t(op - dst) || mlen > size_t(oend - op))
+				return false;
+			const uint8_t* match = op - offset;
+			if (offset >= mlen) {
+				std::memcpy(op, match, mlen);
+				op += mlen;
+			} else {
+				// overlapping matches repeat the last bytes
+				for (size_t i = 0; i < mlen; i++)
+					*op++ = match[i];
+			}
+		}
+		return op == oend;
+	}
+}
@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+# Builds and runs the tests with the plain interpreter, with and without
+# RISCV_DEBUG, and with each of the dispatch engines
+set -e
+run() {
+	local name=$1; shift
+	mkdir -p build_$name
+	pushd build_$name
+	cmake .. "$@"
+	make -j4
+	./tests
+	popd
+}
+run debug
+run interpreter -DRISCV_DEBUG=OFF
+run icache   -DRISCV_DEBUG=OFF -DRISCV_ICACHE=ON
+run blocks   -DRISCV_DEBUG=OFF -DRISCV_BLOCKS=ON
+run threaded -DRISCV_DEBUG=OFF -DRISCV_THREADED=ON
+run batched  -DRISCV_DEBUG=OFF -DRISCV_THREADED=ON -DRISCV_BATCHED_BUDGET=ON
+run jit      -DRISCV_DEBUG=OFF -DRISCV_JIT=ON
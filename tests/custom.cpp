@@ -5,7 +5,7 @@ void test_custom_machine()
 {
 	// this is a custom machine with very little virtual memory
 	const uint64_t m2_memory = 65536;
-	riscv::Machine<riscv::RISCV32> m2 { {}, m2_memory };
+	riscv::Machine<riscv::RISCV32> m2 { std::string_view{}, m2_memory };
 
 	// free the zero-page to reclaim 4k
 	m2.memory.free_pages(0x0, riscv::Page::size());
@@ -4,6 +4,12 @@ extern void test_custom_machine();
 extern void test_crashes();
 extern void test_rv32i();
 extern void test_rv32c();
+extern void test_buffer();
+extern void test_dispatch();
+extern void test_fork();
+extern void test_lz();
+extern void test_snapshot();
+extern void test_tlb();
 
 int main()
 {
@@ -12,6 +18,12 @@ int main()
 	test_crashes();
 	test_rv32i();
 	test_rv32c();
+	test_buffer();
+	test_dispatch();
+	test_fork();
+	test_lz();
+	test_snapshot();
+	test_tlb();
 	printf("Tests passed!\n");
 	return 0;
 }
@@ -0,0 +1,104 @@
+#include "testable_program.hpp"
+#include <libriscv/util/hash.hpp>
+using namespace riscv;
+
+static const uint32_t DATA  = 0x10000;
+static const uint32_t OTHER = 0x20000;
+// a few pages, starting and ending in the middle of one
+static const size_t LEN = 3 * Page::size() + 100;
+
+template <int W>
+static void write_pattern(Machine<W>& machine, uint32_t addr, const std::string& data)
+{
+	machine.copy_to_guest(addr, data.data(), data.size());
+}
+
+// A system call that takes a Buffer argument spanning several pages,
+// and one that is larger than allowed.
+template <int W>
+static void test_syscall_buffers()
+{
+	testable_program p;
+	p.emit(p.addi(A7, ZERO, 500));
+	p.emit(p.ecall());
+	p.exit();
+	const auto binary = p.elf<W>();
+
+	std::string expected(LEN, '\0');
+	for (size_t i = 0; i < LEN; i++) expected[i] = 'a' + i % 23;
+
+	for (const size_t len : { LEN, (size_t) RISCV_SYSCALL_BUFFER_MAX }) {
+		auto machine = testable_machine<W>(binary);
+		write_pattern(*machine, DATA + 100, expected);
+		struct {
+			std::string seen;
+			size_t segments = 0;
+		} result;
+		machine->install_syscall_handler(500,
+			[r = &result] (Machine<W>& m) -> long {
+				const auto buffer = m.template sysarg<riscv::Buffer> (0);
+				r->seen = buffer.to_string();
+				r->segments = buffer.segments();
+				return buffer.size();
+			});
+		machine->cpu.reg(A0) = DATA + 100;
+		machine->cpu.reg(A1) = len;
+		int error = -1;
+		try {
+			machine->simulate();
+		} catch (const MachineException& e) {
+			error = e.type();
+		}
+		if (len == LEN) {
+			assert(error == -1 && result.seen == expected);
+			assert(result.segments >= 1 && result.segments <= 4);
+		} else {
+			assert(error == PROTECTION_FAULT);
+		}
+	}
+}
+
+template <int W>
+static void test_buffer_contents()
+{
+	testable_program p;
+	p.exit();
+	auto machine = testable_machine<W>(p.elf<W>());
+	std::string expected(LEN, '\0');
+	for (size_t i = 0; i < LEN; i++) expected[i] = 'A' + i % 29;
+	write_pattern(*machine, DATA + 100, expected);
+	// the same contents, split into pages in other places
+	write_pattern(*machine, OTHER + 3000, expected);
+	const auto buffer = machine->memory.rvbuffer(DATA + 100, LEN, LEN + 1);
+	const auto other  = machine->memory.rvbuffer(OTHER + 3000, LEN, LEN + 1);
+
+	assert(buffer.size() == LEN && buffer.to_string() == expected);
+	std::string joined;
+	for (const auto& iov : buffer.to_iovec())
+		joined.append((const char*) iov.iov_base, iov.iov_len);
+	assert(buffer.to_iovec().size() == buffer.segments() && joined == expected);
+	assert(buffer.hash() == fnv1a_hash(expected));
+	assert(buffer.hash() == other.hash());
+
+	assert(buffer.compare(expected.data(), LEN) == 0);
+	assert(buffer.compare(expected.data(), LEN - 1) > 0);
+	std::string longer = expected + "x";
+	assert(buffer.compare(longer.data(), longer.size()) < 0);
+	std::string changed = expected;
+	changed[LEN - 1] += 1;
+	assert(buffer.compare(changed.data(), LEN) < 0);
+
+	assert(buffer == other);
+	assert(!(buffer == machine->memory.rvbuffer(OTHER + 3000, LEN - 1, LEN)));
+	machine->memory.template write<uint8_t> (OTHER + 3000 + LEN - 1, changed[LEN - 1]);
+	assert(!(buffer == other));
+	assert(buffer.hash() != other.hash());
+}
+
+void test_buffer()
+{
+	test_syscall_buffers<RISCV32>();
+	test_syscall_buffers<RISCV64>();
+	test_buffer_contents<RISCV32>();
+	test_buffer_contents<RISCV64>();
+}
@@ -0,0 +1,277 @@
+#include "testable_program.hpp"
+#include <libriscv/sequence_profile.hpp>
+#include <random>
+#include <thread>
+#ifdef RISCV_JIT
+#include <libriscv/jit.hpp>
+#endif
+using namespace riscv;
+
+// the data the test programs read and write, at s0
+static const uint32_t DATA = 0x10000;
+static const size_t DATA_LEN = 256;
+
+// Straight-line code with forward branches and jumps, which always
+// reaches the exit at the end.
+template <int W>
+static std::vector<uint8_t> random_program(uint32_t seed, size_t count)
+{
+	std::mt19937 rng { seed };
+	auto pick = [&] (uint32_t n) { return (uint32_t) (rng() % n); };
+	static const uint32_t dst[] = { A0, A1, A2, A3, A4, A5, S1 };
+	static const uint32_t src[] = { ZERO, S0, A0, A1, A2, A3, A4, A5, S1 };
+	auto rd  = [&] { return dst[pick(std::size(dst))]; };
+	auto rs  = [&] { return src[pick(std::size(src))]; };
+	auto imm = [&] { return (int32_t) pick(4096) - 2048; };
+	auto off = [&] { return (int32_t) pick(DATA_LEN / 8) * 8; };
+
+	testable_program p;
+	p.emit(p.lui(S0, DATA >> 12));
+	for (uint32_t reg : dst)
+		p.emit(p.addi(reg, ZERO, imm()));
+	for (size_t i = 0; i < count; i++) {
+		// a forward target at most at the exit
+		const int32_t skip = 4 * (1 + pick(std::min<size_t>(8, count - i)));
+		switch (pick(12)) {
+		case 0: p.emit(p.addi(rd(), rs(), imm())); break;
+		case 1: p.emit(p.add(rd(), rs(), rs())); break;
+		case 2: p.emit(p.sub(rd(), rs(), rs())); break;
+		case 3: p.emit(p.xor_(rd(), rs(), rs())); break;
+		case 4: p.emit(p.sll(rd(), rs(), rs())); break;
+		case 5: p.emit(p.xori(rd(), rs(), imm())); break;
+		case 6: p.emit(p.lui(rd(), pick(1u << 20))); break;
+		case 7: p.emit(p.auipc(rd(), pick(16))); break;
+		case 8: p.emit(p.lreg<W>(rd(), S0, off())); break;
+		case 9: p.emit(p.sreg<W>(rs(), S0, off())); break;
+		case 10:
+			switch (pick(4)) {
+			case 0: p.emit(p.beq(rs(), rs(), skip)); break;
+			case 1: p.emit(p.bne(rs(), rs(), skip)); break;
+			case 2: p.emit(p.blt(rs(), rs(), skip)); break;
+			default: p.emit(p.bgeu(rs(), rs(), skip)); break;
+			}
+			break;
+		default:
+			p.emit(p.jal(pick(2) ? RA : ZERO, skip)); break;
+		}
+	}
+	p.exit();
+	return p.elf<W>();
+}
+
+template <int W>
+static void test_random_programs()
+{
+	for (uint32_t seed = 1; seed <= 40; seed++) {
+		const auto binary = random_program<W>(seed, 200);
+		// to the end, and stopping at every instruction
+		compare_with_interpreter<W>(binary, 0, DATA, DATA_LEN);
+		for (uint64_t limit = 1; limit < 64; limit++)
+			compare_with_interpreter<W>(binary, limit, DATA, DATA_LEN);
+		// resuming where the previous run stopped
+		auto machine = testable_machine<W>(binary);
+		auto reference = testable_machine<W>(binary);
+		for (uint64_t step = 1; !machine->stopped(); step = step % 7 + 1)
+			compare_with_interpreter(*machine, *reference, step, DATA, DATA_LEN);
+	}
+}
+
+// Every fused sequence, run normally and entered in the middle.
+template <int W>
+static std::vector<uint8_t> fused_program()
+{
+	testable_program p;
+	p.emit(p.lui(S0, DATA >> 12));
+	p.emit(p.addi(A1, ZERO, 5));
+	const uint32_t loop = p.here();
+	p.emit(p.lui(A2, 0x12345));
+	const uint32_t mid_lui_addi = p.emit(p.addi(A2, A2, 0x678));
+	p.emit(p.auipc(A3, 0));
+	const uint32_t mid_auipc_addi = p.emit(p.addi(A3, A3, 16));
+	const uint32_t auipc_load = p.emit(p.auipc(A4, 0));
+	const uint32_t mid_auipc_load = p.emit(p.lreg<W>(A4, A4, 0));
+	p.emit(p.add(A5, A5, A2));
+	p.emit(p.add(A5, A5, A3));
+	p.emit(p.add(A5, A5, A4));
+	p.emit(p.sreg<W>(A5, S0, 0));
+	p.emit(p.addi(A1, A1, -1));
+	const uint32_t mid_addi_bne = p.emit(p.bne(A1, ZERO, loop - p.here()));
+	p.emit(p.addi(A6, ZERO, 0));
+	const uint32_t mid_addi_beq = p.emit(p.beq(A6, ZERO, 8));
+	p.emit(p.addi(A5, A5, 1)); // skipped
+	// a near call and a far call
+	const uint32_t call = p.emit(0);
+	const uint32_t far_call = p.emit(p.auipc(A6, 0));
+	const uint32_t mid_auipc_jalr = p.emit(0);
+	// enter the middle of one sequence per round, with a1 = 1
+	const uint32_t dispatch = p.emit(p.addi(S1, S1, 1));
+	p.emit(p.addi(A1, ZERO, 1));
+	std::vector<uint32_t> cases;
+	for (int i = 1; i <= 7; i++) {
+		p.emit(p.addi(A6, ZERO, i));
+		cases.push_back(p.emit(0));
+	}
+	p.exit();
+	std::vector<uint32_t> targets;
+	targets.push_back(p.emit(p.jal(ZERO, mid_lui_addi - p.here())));
+	targets.push_back(p.emit(p.jal(ZERO, mid_auipc_addi - p.here())));
+	// the load uses the address made by the skipped AUIPC
+	targets.push_back(p.emit(p.auipc(A4, 0)));
+	p.emit(p.addi(A4, A4, auipc_load - targets.back()));
+	p.emit(p.jal(ZERO, mid_auipc_load - p.here()));
+	targets.push_back(p.emit(p.jal(ZERO, mid_addi_bne - p.here())));
+	targets.push_back(p.emit(p.jal(ZERO, mid_addi_beq - p.here())));
+	// the far call uses the address made by the skipped AUIPC
+	targets.push_back(p.emit(p.auipc(A6, 0)));
+	p.emit(p.addi(A6, A6, far_call - targets.back()));
+	p.emit(p.jal(ZERO, mid_auipc_jalr - p.here()));
+	const uint32_t ret_cases = p.here();
+	targets.push_back(p.emit(0));
+	p.emit(p.addi(SP, SP, -16));
+	p.emit(0);
+	p.emit(p.jal(ZERO, dispatch - p.here()));
+	// the function ends with a fused return
+	const uint32_t function = p.emit(p.addi(SP, SP, -16));
+	p.emit(p.sreg<W>(RA, SP, 8));
+	p.emit(p.addi(A0, A0, 1));
+	p.emit(p.lreg<W>(RA, SP, 8));
+	const uint32_t mid_ret = p.emit(p.addi(SP, SP, 16));
+	const uint32_t mid_ret_jalr = p.emit(p.jalr(ZERO, RA, 0));
+
+	p.patch(call, p.jal(RA, function - call));
+	p.patch(mid_auipc_jalr, p.jalr(RA, A6, function - far_call));
+	for (size_t i = 0; i < cases.size(); i++)
+		p.patch(cases[i], p.beq(S1, A6, targets[i] - cases[i]));
+	// returns that skip the load, and the load and the stack pop
+	p.patch(ret_cases, p.jal(RA, mid_ret - ret_cases));
+	p.patch(ret_cases + 8, p.jal(RA, mid_ret_jalr - (ret_cases + 8)));
+	return p.elf<W>();
+}
+
+template <int W>
+static void test_fused_sequences()
+{
+	const auto binary = fused_program<W>();
+	// with every sequence fused, and with fusion disabled
+	const FusionTable no_fusion = FusionTable::parse("");
+	for (const FusionTable* table : { (const FusionTable*) nullptr, &no_fusion }) {
+		MachineOptions<W> options;
+		options.fusion_table = table;
+		auto machine = testable_machine<W>(binary, options);
+		auto reference = testable_machine<W>(binary, options);
+		compare_with_interpreter(*machine, *reference, 0, DATA, DATA_LEN);
+		assert(machine->stopped() && machine->cpu.reg(S1) == 8);
+		for (uint64_t limit = 1; limit < machine->cpu.instruction_counter(); limit++)
+			compare_with_interpreter<W>(binary, limit, DATA, DATA_LEN, options);
+	}
+}
+
+// Branches and jumps to the edges of the execute segment, and to
+// addresses that are not instructions.
+template <int W>
+static void test_branch_targets()
+{
+	std::vector<testable_program> programs;
+	auto add = [&] (auto emitter) {
+		testable_program p;
+		p.emit(p.addi(A1, ZERO, 1));
+		emitter(p);
+		p.exit();
+		programs.push_back(p);
+	};
+	// past the end, and before the start of the execute segment
+	add([] (auto& p) { p.emit(p.jal(ZERO, 0x1000)); });
+	add([] (auto& p) { p.emit(p.bne(A1, ZERO, 12)); });
+	add([] (auto& p) { p.emit(p.jal(RA, -8)); });
+	add([] (auto& p) { p.emit(p.beq(A1, A1, -4 - (int) p.here())); });
+	// the last instruction, and the first
+	add([] (auto& p) { p.emit(p.bne(A1, ZERO, 8)); p.emit(p.addi(A2, ZERO, 2)); });
+	add([] (auto& p) { p.emit(p.addi(A1, A1, 1)); p.emit(p.blt(A1, A1, -(int) p.here())); });
+	// the middle of an instruction
+	add([] (auto& p) { p.emit(p.bne(A1, ZERO, 6)); p.emit(p.lui(A2, 0x1)); });
+	add([] (auto& p) { p.emit(p.jal(ZERO, 2)); });
+	// indirect jumps, which clear the lowest bit
+	add([] (auto& p) { p.emit(p.auipc(A2, 0)); p.emit(p.jalr(RA, A2, 9)); p.emit(p.addi(A3, ZERO, 3)); });
+	add([] (auto& p) { p.emit(p.auipc(A2, 0)); p.emit(p.jalr(RA, A2, 0x1001)); });
+	for (const auto& p : programs) {
+		const auto binary = p.elf<W>();
+		compare_with_interpreter<W>(binary, 0);
+		for (uint64_t limit = 1; limit < 8; limit++)
+			compare_with_interpreter<W>(binary, limit);
+	}
+}
+
+// A loop that runs long enough for its blocks to be compiled by the
+// JIT, with a call, a data-dependent branch and (optionally) memory.
+template <int W>
+static std::vector<uint8_t> hot_program(bool use_memory)
+{
+	testable_program p;
+	p.emit(p.lui(S0, DATA >> 12));
+	p.emit(p.addi(A1, ZERO, 2000));
+	const uint32_t loop = p.here();
+	p.emit(p.add(A2, A2, A1));
+	p.emit(p.xori(A3, A2, 0x55));
+	p.emit(p.sll(A4, A3, A1));
+	p.emit(p.sub(A5, A5, A4));
+	if (use_memory) {
+		p.emit(p.sreg<W>(A5, S0, 8));
+		p.emit(p.lbu(A6, S0, 9));
+		p.emit(p.add(A2, A2, A6));
+	}
+	p.emit(p.bgeu(A2, A3, 8));
+	p.emit(p.addi(A5, A5, 3));
+	const uint32_t call = p.emit(0);
+	p.emit(p.addi(A1, A1, -1));
+	p.emit(p.bne(A1, ZERO, loop - p.here()));
+	p.exit();
+	const uint32_t function = p.emit(p.addi(S1, S1, 1));
+	p.emit(p.jalr(ZERO, RA, 0));
+	p.patch(call, p.jal(RA, function - call));
+	return p.elf<W>();
+}
+
+template <int W>
+static void test_hot_loops()
+{
+	const auto binary = hot_program<W>(true);
+	compare_with_interpreter<W>(binary, 0, DATA, DATA_LEN);
+	// stopping inside the compiled blocks
+	auto machine = testable_machine<W>(binary);
+	auto reference = testable_machine<W>(binary);
+	for (uint64_t step = 1; !machine->stopped(); step = step % 97 + 1)
+		compare_with_interpreter(*machine, *reference, step, DATA, DATA_LEN);
+	assert(machine->cpu.reg(S1) == 2000);
+#ifdef RISCV_JIT
+	assert(machine->memory.jit()->compiled_blocks() > 0);
+#endif
+
+	// forks run the blocks while the master is compiling them
+	const auto regs_only = hot_program<W>(false);
+	auto master = testable_machine<W>(regs_only);
+	std::vector<std::unique_ptr<Machine<W>>> forks;
+	for (int i = 0; i < 4; i++)
+		forks.push_back(testable_machine<W>(regs_only, { .owning_machine = master.get() }));
+	std::vector<std::thread> threads;
+	for (auto& fork : forks)
+		threads.emplace_back([&fork] { fork->simulate(); });
+	master->simulate();
+	for (auto& thread : threads)
+		thread.join();
+	for (auto& fork : forks) {
+		assert(fork->stopped());
+		assert(same_state(*fork, *master));
+	}
+}
+
+void test_dispatch()
+{
+	test_random_programs<RISCV32>();
+	test_random_programs<RISCV64>();
+	test_fused_sequences<RISCV32>();
+	test_fused_sequences<RISCV64>();
+	test_branch_targets<RISCV32>();
+	test_branch_targets<RISCV64>();
+	test_hot_loops<RISCV32>();
+	test_hot_loops<RISCV64>();
+}
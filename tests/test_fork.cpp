@@ -0,0 +1,146 @@
+#include "testable_program.hpp"
+#include <libriscv/fork_pool.hpp>
+using namespace riscv;
+
+static const uint32_t DATA = 0x10000;
+// a page that the master does not have
+static const uint32_t FRESH = DATA + 0x1000;
+
+// Increments the word at DATA, and copies it to FRESH.
+template <int W>
+static std::vector<uint8_t> fork_program()
+{
+	testable_program p;
+	p.emit(p.lui(S0, DATA >> 12));
+	p.emit(p.lui(S1, FRESH >> 12));
+	p.emit(p.lw(A1, S0, 0));
+	p.emit(p.addi(A1, A1, 1));
+	p.emit(p.sw(A1, S0, 0));
+	p.emit(p.sw(A1, S1, 0));
+	p.exit();
+	return p.elf<W>();
+}
+
+template <int W>
+static uint32_t word(Machine<W>& machine, uint32_t addr)
+{
+	return machine.memory.template read<uint32_t> (addr);
+}
+
+// the fork is back where it was forked from @master
+template <int W>
+static bool same_as_parent(Machine<W>& fork, Machine<W>& master, uint32_t data)
+{
+	return !fork.stopped() && same_state(fork, master)
+		&& word(fork, DATA) == data && word(fork, FRESH) == 0;
+}
+
+template <int W>
+static void test_fork_isolation(bool lazy)
+{
+	const auto binary = fork_program<W>();
+	auto master = testable_machine<W>(binary);
+	master->memory.template write<uint32_t> (DATA, 100);
+	const MachineOptions<W> options { .owning_machine = master.get(), .lazy_fork = lazy };
+	auto fork1 = testable_machine<W>(binary, options);
+	auto fork2 = testable_machine<W>(binary, options);
+	assert(same_as_parent(*fork1, *master, 100));
+
+	fork1->simulate();
+	assert(fork1->stopped() && fork1->cpu.reg(A1) == 101);
+	assert(word(*fork1, DATA) == 101 && word(*fork1, FRESH) == 101);
+	// the master and the other fork don't see the writes
+	assert(word(*master, DATA) == 100 && word(*master, FRESH) == 0);
+	assert(same_as_parent(*fork2, *master, 100));
+	fork2->simulate();
+	assert(fork2->cpu.reg(A1) == 101);
+	// freeing a page hides the master's page only in the fork
+	fork2->memory.free_pages(DATA, Page::size());
+	assert(word(*fork2, DATA) == 0 && word(*master, DATA) == 100);
+
+	// a fork of a fork
+	auto fork3 = testable_machine<W>(binary, { .owning_machine = fork1.get(), .lazy_fork = lazy });
+	assert(word(*fork3, DATA) == 101 && word(*fork3, FRESH) == 101);
+	fork3->cpu.jump(master->cpu.pc());
+	fork3->simulate();
+	assert(fork3->cpu.reg(A1) == 102);
+	assert(word(*fork1, DATA) == 101 && word(*master, DATA) == 100);
+	fork3->reset_to_parent();
+	assert(word(*fork3, DATA) == 101 && word(*fork3, FRESH) == 101);
+	assert(same_state(*fork3, *fork1));
+}
+
+template <int W>
+static void test_reset_to_parent(bool lazy)
+{
+	const auto binary = fork_program<W>();
+	auto master = testable_machine<W>(binary);
+	master->memory.template write<uint32_t> (DATA, 100);
+	auto fork = testable_machine<W>(binary, { .owning_machine = master.get(), .lazy_fork = lazy });
+	// the same run every time, from the same state
+	for (int round = 0; round < 3; round++) {
+		fork->simulate();
+		assert(fork->stopped() && fork->cpu.reg(A1) == 101);
+		assert(word(*fork, DATA) == 101 && word(*fork, FRESH) == 101);
+		// pages freed and written again many times
+		for (int i = 0; i < 50; i++) {
+			fork->memory.free_pages(DATA, 2 * Page::size());
+			fork->memory.template write<uint32_t> (FRESH, i);
+		}
+		fork->memory.free_pages(DATA, Page::size());
+		fork->reset_to_parent();
+		assert(same_as_parent(*fork, *master, 100));
+	}
+	// also when nothing was written
+	fork->reset_to_parent();
+	assert(same_as_parent(*fork, *master, 100));
+	// only forks have a parent
+	int error = -1;
+	try {
+		master->reset_to_parent();
+	} catch (const MachineException& e) {
+		error = e.type();
+	}
+	assert(error == ILLEGAL_OPERATION);
+}
+
+template <int W>
+static void test_fork_pool()
+{
+	const auto binary = fork_program<W>();
+	auto master = testable_machine<W>(binary);
+	master->memory.template write<uint32_t> (DATA, 100);
+	ForkPool<W> pool { *master, 2 };
+	assert(pool.available() == 2 && pool.capacity() == 2);
+
+	std::vector<typename ForkPool<W>::machine_ptr> forks;
+	for (int i = 0; i < 3; i++) {
+		forks.push_back(pool.acquire());
+		auto& fork = *forks.back();
+		fork.install_syscall_handler(93,
+			[] (Machine<W>& m) -> long { m.stop(); return 0; });
+		assert(same_as_parent(fork, *master, 100));
+		fork.simulate();
+		assert(fork.cpu.reg(A1) == 101 && word(fork, DATA) == 101);
+	}
+	assert(pool.available() == 0);
+	// given back reset, and the one over the capacity is dropped
+	for (auto& fork : forks)
+		pool.release(std::move(fork));
+	assert(pool.available() == 2);
+	auto fork = pool.acquire();
+	assert(same_as_parent(*fork, *master, 100));
+	assert(word(*master, DATA) == 100 && word(*master, FRESH) == 0);
+}
+
+void test_fork()
+{
+	for (bool lazy : { false, true }) {
+		test_fork_isolation<RISCV32>(lazy);
+		test_fork_isolation<RISCV64>(lazy);
+		test_reset_to_parent<RISCV32>(lazy);
+		test_reset_to_parent<RISCV64>(lazy);
+	}
+	test_fork_pool<RISCV32>();
+	test_fork_pool<RISCV64>();
+}
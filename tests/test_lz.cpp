@@ -0,0 +1,93 @@
+#include <libriscv/util/lz.hpp>
+#include <cassert>
+#include <random>
+#include <vector>
+using namespace riscv;
+
+static std::vector<uint8_t> compress(const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> out(lz::max_size(data.size()));
+	const size_t len = lz::compress(data.data(), data.size(), out.data());
+	assert(len <= out.size());
+	out.resize(len);
+	return out;
+}
+
+static bool decompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& dst)
+{
+	return lz::decompress(src.data(), src.size(), dst.data(), dst.size());
+}
+
+static std::vector<uint8_t> roundtrip(const std::vector<uint8_t>& data)
+{
+	const auto compressed = compress(data);
+	std::vector<uint8_t> out(data.size());
+	assert(decompress(compressed, out));
+	assert(out == data);
+	return compressed;
+}
+
+static void test_roundtrips()
+{
+	std::mt19937 rng { 1234 };
+	// random data around the literal length encodings
+	for (size_t len : { 0, 1, 4, 14, 15, 16, 269, 270, 271, 4096, 70000 }) {
+		std::vector<uint8_t> data(len);
+		for (auto& b : data) b = rng();
+		roundtrip(data);
+	}
+	// long matches, and overlapping ones
+	const std::vector<uint8_t> zero(4096);
+	assert(roundtrip(zero).size() < 64);
+	std::vector<uint8_t> pattern(4096);
+	for (size_t i = 0; i < pattern.size(); i++) pattern[i] = "abc"[i % 3];
+	assert(roundtrip(pattern).size() < 64);
+	// matches too far back to refer to
+	std::vector<uint8_t> far(140000);
+	for (size_t i = 0; i < 70000; i++) far[i] = far[i + 70000] = rng();
+	roundtrip(far);
+	// short runs between literals, like a page of a guest
+	std::vector<uint8_t> mixed(4096);
+	for (size_t i = 0; i < mixed.size(); i++)
+		mixed[i] = (rng() % 4 == 0) ? rng() : mixed[i / 2];
+	roundtrip(mixed);
+}
+
+static void test_malformed()
+{
+	std::vector<uint8_t> page(4096);
+	for (size_t i = 0; i < page.size(); i++) page[i] = (i % 64 < 16) ? i : 0;
+	const auto compressed = compress(page);
+	std::vector<uint8_t> out(page.size());
+	// every truncation, and the wrong size
+	for (size_t len = 0; len < compressed.size(); len++) {
+		const std::vector<uint8_t> truncated(compressed.begin(), compressed.begin() + len);
+		assert(!decompress(truncated, out));
+	}
+	std::vector<uint8_t> smaller(page.size() - 1), larger(page.size() + 1);
+	assert(!decompress(compressed, smaller));
+	assert(!decompress(compressed, larger));
+
+	// offsets of zero and before the start, and a length past the end
+	std::vector<uint8_t> small(16);
+	assert(!decompress({ 0x10, 'a', 0x00, 0x00, 0x00 }, small));
+	assert(!decompress({ 0x10, 'a', 0x02, 0x00, 0x00 }, small));
+	assert(!decompress({ 0x1F, 'a', 0x01, 0x00, 0xFF }, small));
+	assert(!decompress({ 0xF0, 0xFF, 0xFF }, small));
+	assert(!decompress({ 0x20, 'a' }, small));
+
+	// random changes are refused or stay inside the output
+	std::mt19937 rng { 5678 };
+	for (int i = 0; i < 2000; i++) {
+		auto corrupt = compressed;
+		for (int n = 0; n <= i % 4; n++)
+			corrupt[rng() % corrupt.size()] = rng();
+		decompress(corrupt, out);
+	}
+}
+
+void test_lz()
+{
+	test_roundtrips();
+	test_malformed();
+}
@@ -6,8 +6,10 @@ using namespace riscv;
 void test_rv32c()
 {
 	const uint32_t memory = 65536;
-	riscv::Machine<RISCV32> machine { {}, memory };
+	riscv::Machine<RISCV32> machine { std::string_view{}, memory };
+#ifdef RISCV_DEBUG
 	machine.verbose_instructions = true;
+#endif
 
 	// C.SRLI imm = [0, 31] CI_CODE(0b100, 0b01):
 	for (int i = 0; i < 32; i++)
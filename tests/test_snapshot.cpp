@@ -0,0 +1,295 @@
+#include "testable_program.hpp"
+#include <libriscv/mapped_file.hpp>
+#include <unistd.h>
+using namespace riscv;
+
+static const uint32_t DATA = 0x10000;
+static const size_t DATA_LEN = 16 * Page::size();
+
+// Writes a running sum to every 1 KiB of 16 pages at DATA.
+template <int W>
+static std::vector<uint8_t> snapshot_program(int32_t seed)
+{
+	testable_program p;
+	p.emit(p.lui(S0, DATA >> 12));
+	p.emit(p.addi(A1, ZERO, DATA_LEN / 1024));
+	p.emit(p.addi(A2, ZERO, seed));
+	const uint32_t loop = p.here();
+	p.emit(p.add(A2, A2, A1));
+	p.emit(p.sw(A2, S0, 0));
+	p.emit(p.addi(S0, S0, 1024));
+	p.emit(p.addi(A1, A1, -1));
+	p.emit(p.bne(A1, ZERO, loop - p.here()));
+	p.exit();
+	return p.elf<W>();
+}
+
+// the result of restoring @vec, where exceptions are -100
+template <int W>
+static int restore(Machine<W>& machine, const std::vector<uint8_t>& vec)
+{
+	try {
+		return machine.deserialize_from(vec);
+	} catch (const MachineException&) {
+		return -100;
+	}
+}
+
+// runs both machines to the end, which has to be the same
+template <int W>
+static void finish_both(Machine<W>& machine, Machine<W>& restored)
+{
+	assert(same_state(machine, restored, DATA, DATA_LEN));
+	machine.simulate();
+	restored.simulate();
+	assert(machine.stopped() && restored.stopped());
+	assert(same_state(machine, restored, DATA, DATA_LEN));
+}
+
+template <int W>
+static void test_full_snapshots()
+{
+	const auto binary = snapshot_program<W>(1);
+	auto machine = testable_machine<W>(binary);
+	machine->simulate(100);
+	std::vector<uint8_t> vec;
+	machine->serialize_to(vec);
+	auto restored = testable_machine<W>(binary);
+	assert(restore(*restored, vec) == 0);
+	finish_both(*machine, *restored);
+
+	// every truncation fails
+	for (size_t len = 0; len < vec.size(); len += (len < 256) ? 1 : 509) {
+		const std::vector<uint8_t> truncated(vec.begin(), vec.begin() + len);
+		assert(restore(*restored, truncated) < 0);
+	}
+	// a snapshot from somewhere else
+	auto corrupt = vec;
+	corrupt[0] ^= 0xFF;
+	assert(restore(*restored, corrupt) == -1);
+	// and restoring a full snapshot twice is the same
+	auto again = testable_machine<W>(binary);
+	assert(restore(*again, vec) == 0);
+	assert(restore(*again, vec) == 0);
+	again->simulate();
+	assert(same_state(*machine, *again, DATA, DATA_LEN));
+}
+
+template <int W>
+static void test_delta_snapshots()
+{
+	const auto binary = snapshot_program<W>(2);
+	auto machine = testable_machine<W>(binary);
+	// deltas need a snapshot to build on
+	std::vector<uint8_t> first;
+	bool thrown = false;
+	try {
+		machine->serialize_delta_to(first);
+	} catch (const MachineException&) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	machine->simulate(30);
+	machine->serialize_to(first);
+	std::vector<std::vector<uint8_t>> deltas;
+	for (int i = 0; i < 3; i++) {
+		machine->simulate(20);
+		// an erased page, which is read as zero after the delta
+		if (i == 1)
+			machine->memory.free_pages(DATA, Page::size());
+		deltas.emplace_back();
+		machine->serialize_delta_to(deltas.back());
+	}
+	assert(machine->memory.template read<uint32_t> (DATA) == 0);
+
+	auto restored = testable_machine<W>(binary);
+	assert(restore(*restored, first) == 0);
+	// out of order, and twice, is refused
+	assert(restore(*restored, deltas[1]) == -5);
+	assert(restore(*restored, deltas[0]) == 0);
+	assert(restore(*restored, deltas[0]) == -5);
+	assert(restore(*restored, deltas[1]) == 0);
+	assert(restore(*restored, deltas[2]) == 0);
+	finish_both(*machine, *restored);
+
+	// nor on top of memory that changed after the snapshot
+	for (const bool erase : { false, true }) {
+		auto diverged = testable_machine<W>(binary);
+		assert(restore(*diverged, first) == 0);
+		if (erase)
+			diverged->memory.free_pages(DATA, Page::size());
+		else
+			diverged->memory.template write<uint32_t> (DATA + DATA_LEN, 1);
+		assert(restore(*diverged, deltas[0]) == -5);
+	}
+
+	// truncated deltas fail on top of the right snapshot
+	for (const auto& delta : deltas) {
+		for (size_t len = 0; len < delta.size(); len += (len < 256) ? 1 : 509) {
+			const std::vector<uint8_t> truncated(delta.begin(), delta.begin() + len);
+			auto target = testable_machine<W>(binary);
+			assert(restore(*target, first) == 0);
+			assert(restore(*target, truncated) < 0);
+		}
+	}
+
+	// a delta with only an erased page, and an erased count too large.
+	// The page is listed once, and pages that were not there are not.
+	auto base = testable_machine<W>(binary);
+	base->memory.template write<uint32_t> (DATA, 1234);
+	std::vector<uint8_t> full, erased;
+	base->serialize_to(full);
+	base->memory.free_pages(DATA, Page::size());
+	base->memory.template write<uint32_t> (DATA, 0);
+	base->memory.free_pages(DATA, Page::size());
+	base->memory.free_pages(DATA + DATA_LEN, Page::size());
+	base->serialize_delta_to(erased);
+	uint64_t listed;
+	std::memcpy(&listed, &erased[erased.size() - 16], sizeof(listed));
+	assert(listed == 1);
+	auto target = testable_machine<W>(binary);
+	assert(restore(*target, full) == 0);
+	assert(target->memory.template read<uint32_t> (DATA) == 1234);
+	auto oversized = erased;
+	const uint64_t n_erased = UINT64_MAX / 8;
+	std::memcpy(&oversized[oversized.size() - 16], &n_erased, sizeof(n_erased));
+	assert(restore(*target, oversized) == -100);
+	assert(restore(*target, erased) == 0);
+	assert(target->memory.template read<uint32_t> (DATA) == 0);
+}
+
+// @vec in a file, mapped and already unlinked
+static std::unique_ptr<MappedFile> mapped_file(const std::vector<uint8_t>& vec)
+{
+	char path[] = "/tmp/libriscv_snapshot_XXXXXX";
+	const int fd = mkstemp(path);
+	assert(fd >= 0);
+	// not inside assert, which does nothing with NDEBUG
+	const ssize_t written = write(fd, vec.data(), vec.size());
+	assert(written == (ssize_t) vec.size());
+	(void) written;
+	close(fd);
+	auto file = std::make_unique<MappedFile> (path);
+	unlink(path);
+	return file;
+}
+
+template <int W>
+static int restore_mapped(Machine<W>& machine, const uint8_t* data, size_t size)
+{
+	try {
+		return machine.deserialize_mapped(data, size);
+	} catch (const MachineException&) {
+		return -100;
+	}
+}
+
+template <int W>
+static void test_mapped_snapshots()
+{
+	const auto binary = snapshot_program<W>(3);
+	auto machine = testable_machine<W>(binary);
+	machine->simulate(100);
+	std::vector<uint8_t> vec;
+	machine->serialize_aligned_to(vec);
+	const auto file = mapped_file(vec);
+
+	auto restored = testable_machine<W>(binary);
+	assert(restore_mapped(*restored, file->data(), file->size()) == 0);
+	// aligned snapshots can also be restored by copying
+	auto copied = testable_machine<W>(binary);
+	assert(restore(*copied, vec) == 0);
+	assert(same_state(*restored, *copied, DATA, DATA_LEN));
+
+	// with a delta on top, and written to, which leaves the file as it was
+	machine->simulate(20);
+	std::vector<uint8_t> delta;
+	machine->serialize_delta_to(delta);
+	assert(restore(*restored, delta) == 0);
+	finish_both(*machine, *restored);
+	auto again = testable_machine<W>(binary);
+	assert(restore_mapped(*again, file->data(), file->size()) == 0);
+	assert(same_state(*again, *copied, DATA, DATA_LEN));
+
+	// snapshots of a mapped machine have the mapped pages in them
+	std::vector<uint8_t> resaved;
+	restored->serialize_to(resaved);
+	auto from_mapped = testable_machine<W>(binary);
+	assert(restore(*from_mapped, resaved) == 0);
+	assert(same_state(*from_mapped, *machine, DATA, DATA_LEN));
+
+	// unaligned data, snapshots that are not aligned, and truncated ones
+	std::vector<uint8_t> storage(vec.size() + 2 * Page::size());
+	auto* buffer = (uint8_t*) (((uintptr_t) storage.data() + Page::size() - 1) & ~(uintptr_t) (Page::size() - 1));
+	std::memcpy(&buffer[1], vec.data(), vec.size());
+	assert(restore_mapped(*again, &buffer[1], vec.size()) == -6);
+	std::vector<uint8_t> unaligned;
+	again->serialize_to(unaligned);
+	std::memcpy(&buffer[0], unaligned.data(), unaligned.size());
+	assert(restore_mapped(*again, &buffer[0], unaligned.size()) == -6);
+	for (size_t len = 0; len < vec.size(); len += (len < 256) ? 1 : 509)
+		assert(restore_mapped(*again, file->data(), len) < 0);
+}
+
+template <int W>
+static void test_compact_snapshots()
+{
+	const auto binary = snapshot_program<W>(4);
+	auto machine = testable_machine<W>(binary);
+	machine->simulate(100);
+	// a page that was written and is zero again, and two equal pages
+	const uint32_t extra = DATA + DATA_LEN;
+	machine->memory.template write<uint32_t> (extra, 1);
+	machine->memory.template write<uint32_t> (extra, 0);
+	for (uint32_t i = 0; i < Page::size(); i += 4) {
+		machine->memory.template write<uint32_t> (extra + Page::size() + i, i * 7);
+		machine->memory.template write<uint32_t> (extra + 2 * Page::size() + i, i * 7);
+	}
+	std::vector<uint8_t> full;
+	machine->serialize_to(full);
+
+	for (const bool compress : { false, true }) {
+		std::vector<uint8_t> vec;
+		const auto stats = machine->serialize_compact_to(vec, compress);
+		assert(stats.bytes == vec.size() && vec.size() < full.size());
+		assert(stats.zero >= 1 && stats.duplicate >= 1);
+		assert((stats.compressed != 0) == compress);
+		auto restored = testable_machine<W>(binary);
+		assert(restore(*restored, vec) == 0);
+		assert(same_state(*machine, *restored, extra, 3 * Page::size()));
+
+		// only for the same binary
+		const auto other_binary = snapshot_program<W>(5);
+		auto other = testable_machine<W>(other_binary);
+		assert(restore(*other, vec) == -7);
+		// truncated and corrupt snapshots fail, or restore something
+		auto target = testable_machine<W>(binary);
+		for (size_t len = 0; len < vec.size(); len += (len < 256) ? 1 : 97) {
+			const std::vector<uint8_t> truncated(vec.begin(), vec.begin() + len);
+			assert(restore(*target, truncated) < 0);
+		}
+		size_t refused = 0;
+		for (size_t i = 0; i < vec.size(); i++) {
+			auto corrupt = vec;
+			corrupt[i] ^= 0xFF;
+			refused += restore(*target, corrupt) < 0;
+		}
+		assert(refused > 0);
+		finish_both(*machine, *restored);
+		// back to the state of the snapshot
+		assert(restore(*machine, full) == 0);
+	}
+}
+
+void test_snapshot()
+{
+	test_full_snapshots<RISCV32>();
+	test_full_snapshots<RISCV64>();
+	test_delta_snapshots<RISCV32>();
+	test_delta_snapshots<RISCV64>();
+	test_mapped_snapshots<RISCV32>();
+	test_mapped_snapshots<RISCV64>();
+	test_compact_snapshots<RISCV32>();
+	test_compact_snapshots<RISCV64>();
+}
@@ -0,0 +1,118 @@
+#include "testable_program.hpp"
+using namespace riscv;
+
+static const uint32_t DATA = 0x10000;
+// a page that uses the same data TLB entries as DATA
+static const uint32_t ALIAS = DATA + RISCV_DATA_TLB_SIZE * Page::size();
+
+// the type of the exception thrown by @access, or -1
+template <typename Func>
+static int exception_type(Func access)
+{
+	try {
+		access();
+	} catch (const MachineException& e) {
+		return e.type();
+	}
+	return -1;
+}
+
+// Pages that are already in the TLB have their attributes changed,
+// or are removed or replaced, from the host.
+template <int W>
+static void test_host_accesses()
+{
+	testable_program p;
+	p.exit();
+	auto machine = testable_machine<W>(p.elf<W>());
+	auto& mem = machine->memory;
+
+	mem.template write<uint32_t> (DATA, 0x1234);
+	assert(mem.template read<uint32_t> (DATA) == 0x1234);
+	mem.set_page_attr(DATA, Page::size(), { .read = false, .write = true });
+	assert(exception_type([&] { mem.template read<uint32_t> (DATA); }) == PROTECTION_FAULT);
+	mem.template write<uint32_t> (DATA, 0x5678);
+	mem.set_page_attr(DATA, Page::size(), { .read = true, .write = false });
+	assert(mem.template read<uint32_t> (DATA) == 0x5678);
+	assert(exception_type([&] { mem.template write<uint32_t> (DATA, 0); }) == PROTECTION_FAULT);
+	mem.set_page_attr(DATA, Page::size(), {});
+	mem.template write<uint32_t> (DATA, 0x9ABC);
+	assert(mem.template read<uint32_t> (DATA) == 0x9ABC);
+
+	// freed pages read as zero again, and are created again on write
+	mem.free_pages(DATA, Page::size());
+	assert(mem.template read<uint32_t> (DATA) == 0);
+	mem.template write<uint32_t> (DATA, 0x1111);
+	assert(mem.template read<uint32_t> (DATA) == 0x1111);
+
+	// pages that share TLB entries
+	mem.template write<uint32_t> (ALIAS, 0x2222);
+	for (int i = 0; i < 4; i++) {
+		assert(mem.template read<uint32_t> (DATA) == 0x1111);
+		assert(mem.template read<uint32_t> (ALIAS) == 0x2222);
+	}
+	mem.set_page_attr(ALIAS, Page::size(), { .read = false, .write = false });
+	assert(mem.template read<uint32_t> (DATA) == 0x1111);
+	mem.template write<uint32_t> (DATA, 0x3333);
+	assert(exception_type([&] { mem.template read<uint32_t> (ALIAS); }) == PROTECTION_FAULT);
+	assert(exception_type([&] { mem.template write<uint32_t> (ALIAS, 0); }) == PROTECTION_FAULT);
+	assert(mem.template read<uint32_t> (DATA) == 0x3333);
+	mem.free_pages(DATA, Page::size());
+	assert(mem.template read<uint32_t> (DATA) == 0);
+	assert(exception_type([&] { mem.template read<uint32_t> (ALIAS); }) == PROTECTION_FAULT);
+
+	// a shared page over a page that was read as zero
+	const uint32_t shared_addr = DATA + Page::size();
+	assert(mem.template read<uint32_t> (shared_addr) == 0);
+	Page shared { PageAttributes{} };
+	shared.aligned_write<uint32_t> (0, 0x4444);
+	mem.install_shared_page(shared_addr >> Page::SHIFT, shared);
+	assert(mem.template read<uint32_t> (shared_addr) == 0x4444);
+}
+
+// The same, from system calls made by a guest program in the middle
+// of running, so that the dispatch engines see the changes too.
+template <int W>
+static void test_guest_accesses()
+{
+	testable_program p;
+	p.emit(p.lui(S0, DATA >> 12));
+	p.emit(p.lw(A1, S0, 0));
+	p.emit(p.addi(A7, ZERO, 500));
+	p.emit(p.ecall());
+	p.emit(p.lw(A2, S0, 0));
+	p.emit(p.sw(S0, S0, 0));
+	p.emit(p.lw(A3, S0, 0));
+	p.emit(p.addi(A7, ZERO, 501));
+	p.emit(p.ecall());
+	p.emit(p.lw(A4, S0, 0));
+	p.exit();
+	auto machine = testable_machine<W>(p.elf<W>());
+	machine->install_syscall_handler(500,
+		[] (Machine<W>& m) -> long { m.memory.free_pages(DATA, Page::size()); return 0; });
+	machine->install_syscall_handler(501,
+		[] (Machine<W>& m) -> long {
+			m.memory.set_page_attr(DATA, Page::size(), { .read = false, .write = true });
+			return 0;
+		});
+	machine->memory.template write<uint32_t> (DATA, 0x1234);
+	int error = -1;
+	try {
+		machine->simulate();
+	} catch (const MachineException& e) {
+		error = e.type();
+	}
+	assert(error == PROTECTION_FAULT);
+	assert(machine->cpu.reg(A1) == 0x1234);
+	assert(machine->cpu.reg(A2) == 0);
+	assert(machine->cpu.reg(A3) == DATA);
+	assert(machine->cpu.reg(A4) == 0);
+}
+
+void test_tlb()
+{
+	test_host_accesses<RISCV32>();
+	test_host_accesses<RISCV64>();
+	test_guest_accesses<RISCV32>();
+	test_guest_accesses<RISCV64>();
+}
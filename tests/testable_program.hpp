@@ -0,0 +1,197 @@
+#pragma once
+#include <libriscv/machine.hpp>
+#include <cassert>
+#include <cstdio>
+#include <memory>
+
+namespace riscv
+{
+	// register names used by the test programs
+	enum testable_reg : uint32_t {
+		ZERO = 0, RA = 1, SP = 2, S0 = 8, S1 = 9,
+		A0 = 10, A1, A2, A3, A4, A5, A6, A7,
+	};
+
+	// A tiny assembler for test programs. The code is placed in the
+	// execute segment of an ELF, so that it goes through the decoder
+	// cache and the dispatch engine that the library is built with.
+	struct testable_program
+	{
+		static constexpr uint64_t BASE = 0x1000;
+		std::vector<uint8_t> code;
+
+		uint32_t here() const noexcept { return code.size(); }
+		uint32_t emit(uint32_t instr) {
+			const uint32_t offset = here();
+			for (int i = 0; i < 4; i++)
+				code.push_back(instr >> (8 * i));
+			return offset;
+		}
+		void patch(uint32_t offset, uint32_t instr) {
+			for (int i = 0; i < 4; i++)
+				code.at(offset + i) = instr >> (8 * i);
+		}
+		// li a7, 93; ecall
+		void exit() {
+			emit(addi(A7, ZERO, 93));
+			emit(ecall());
+		}
+
+		static uint32_t R(uint32_t op, uint32_t rd, uint32_t f3, uint32_t rs1, uint32_t rs2, uint32_t f7 = 0) {
+			return op | rd << 7 | f3 << 12 | rs1 << 15 | rs2 << 20 | f7 << 25;
+		}
+		static uint32_t I(uint32_t op, uint32_t rd, uint32_t f3, uint32_t rs1, int32_t imm) {
+			return op | rd << 7 | f3 << 12 | rs1 << 15 | ((uint32_t) imm & 0xFFF) << 20;
+		}
+		static uint32_t S(uint32_t f3, uint32_t rs1, uint32_t rs2, int32_t imm) {
+			const uint32_t u = imm;
+			return 0x23 | (u & 0x1F) << 7 | f3 << 12 | rs1 << 15 | rs2 << 20 | ((u >> 5) & 0x7F) << 25;
+		}
+		static uint32_t B(uint32_t f3, uint32_t rs1, uint32_t rs2, int32_t offset) {
+			const uint32_t u = offset;
+			return 0x63 | ((u >> 11) & 1) << 7 | ((u >> 1) & 0xF) << 8 | f3 << 12
+				| rs1 << 15 | rs2 << 20 | ((u >> 5) & 0x3F) << 25 | ((u >> 12) & 1) << 31;
+		}
+		static uint32_t J(uint32_t rd, int32_t offset) {
+			const uint32_t u = offset;
+			return 0x6F | rd << 7 | ((u >> 12) & 0xFF) << 12 | ((u >> 11) & 1) << 20
+				| ((u >> 1) & 0x3FF) << 21 | ((u >> 20) & 1) << 31;
+		}
+
+		static uint32_t lui(uint32_t rd, uint32_t imm20)   { return 0x37 | rd << 7 | imm20 << 12; }
+		static uint32_t auipc(uint32_t rd, uint32_t imm20) { return 0x17 | rd << 7 | imm20 << 12; }
+		static uint32_t addi(uint32_t rd, uint32_t rs1, int32_t imm) { return I(0x13, rd, 0, rs1, imm); }
+		static uint32_t xori(uint32_t rd, uint32_t rs1, int32_t imm) { return I(0x13, rd, 4, rs1, imm); }
+		static uint32_t add(uint32_t rd, uint32_t rs1, uint32_t rs2) { return R(0x33, rd, 0, rs1, rs2); }
+		static uint32_t sub(uint32_t rd, uint32_t rs1, uint32_t rs2) { return R(0x33, rd, 0, rs1, rs2, 0x20); }
+		static uint32_t xor_(uint32_t rd, uint32_t rs1, uint32_t rs2) { return R(0x33, rd, 4, rs1, rs2); }
+		static uint32_t sll(uint32_t rd, uint32_t rs1, uint32_t rs2) { return R(0x33, rd, 1, rs1, rs2); }
+		static uint32_t lw(uint32_t rd, uint32_t rs1, int32_t imm)   { return I(0x03, rd, 2, rs1, imm); }
+		static uint32_t ld(uint32_t rd, uint32_t rs1, int32_t imm)   { return I(0x03, rd, 3, rs1, imm); }
+		static uint32_t lbu(uint32_t rd, uint32_t rs1, int32_t imm)  { return I(0x03, rd, 4, rs1, imm); }
+		static uint32_t sw(uint32_t rs2, uint32_t rs1, int32_t imm)  { return S(2, rs1, rs2, imm); }
+		static uint32_t sd(uint32_t rs2, uint32_t rs1, int32_t imm)  { return S(3, rs1, rs2, imm); }
+		static uint32_t sb(uint32_t rs2, uint32_t rs1, int32_t imm)  { return S(0, rs1, rs2, imm); }
+		static uint32_t beq(uint32_t rs1, uint32_t rs2, int32_t off)  { return B(0, rs1, rs2, off); }
+		static uint32_t bne(uint32_t rs1, uint32_t rs2, int32_t off)  { return B(1, rs1, rs2, off); }
+		static uint32_t blt(uint32_t rs1, uint32_t rs2, int32_t off)  { return B(4, rs1, rs2, off); }
+		static uint32_t bgeu(uint32_t rs1, uint32_t rs2, int32_t off) { return B(7, rs1, rs2, off); }
+		static uint32_t jal(uint32_t rd, int32_t off) { return J(rd, off); }
+		static uint32_t jalr(uint32_t rd, uint32_t rs1, int32_t imm) { return I(0x67, rd, 0, rs1, imm); }
+		static uint32_t ecall() { return 0x73; }
+		// the register-sized load and store
+		template <int W>
+		static uint32_t lreg(uint32_t rd, uint32_t rs1, int32_t imm) { return (W == 4) ? lw(rd, rs1, imm) : ld(rd, rs1, imm); }
+		template <int W>
+		static uint32_t sreg(uint32_t rs2, uint32_t rs1, int32_t imm) { return (W == 4) ? sw(rs2, rs1, imm) : sd(rs2, rs1, imm); }
+
+		// an ELF with the code as its only (executable) segment
+		template <int W>
+		std::vector<uint8_t> elf() const
+		{
+			using Ehdr = typename Elf<W>::Ehdr;
+			using Phdr = typename Elf<W>::Phdr;
+			std::vector<uint8_t> bin(sizeof(Ehdr) + sizeof(Phdr));
+			auto* ehdr = (Ehdr*) bin.data();
+			std::memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+			ehdr->e_ident[EI_CLASS] = (W == 4) ? ELFCLASS32 : ELFCLASS64;
+			ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+			ehdr->e_machine = EM_RISCV;
+			ehdr->e_version = EV_CURRENT;
+			ehdr->e_entry = BASE;
+			ehdr->e_phoff = sizeof(Ehdr);
+			ehdr->e_ehsize = sizeof(Ehdr);
+			ehdr->e_phentsize = sizeof(Phdr);
+			ehdr->e_phnum = 1;
+			auto* phdr = (Phdr*) &bin[sizeof(Ehdr)];
+			phdr->p_type = PT_LOAD;
+			phdr->p_offset = bin.size();
+			phdr->p_vaddr = phdr->p_paddr = BASE;
+			phdr->p_filesz = phdr->p_memsz = code.size();
+			phdr->p_flags = PF_R | PF_X;
+			phdr->p_align = Page::size();
+			bin.insert(bin.end(), code.begin(), code.end());
+			return bin;
+		}
+	};
+
+	// a machine for @binary that stops on the exit system call
+	template <int W>
+	inline std::unique_ptr<Machine<W>> testable_machine(
+		const std::vector<uint8_t>& binary, MachineOptions<W> options = {})
+	{
+		options.memory_max = 16ull << 20;
+		auto machine = std::make_unique<Machine<W>> (binary, std::move(options));
+		machine->install_syscall_handler(93,
+			[] (Machine<W>& m) -> long { m.stop(); return 0; });
+		return machine;
+	}
+
+	template <int W>
+	inline bool same_state(Machine<W>& a, Machine<W>& b,
+		address_type<W> mem_addr = 0, size_t mem_len = 0)
+	{
+		bool same = a.cpu.pc() == b.cpu.pc()
+			&& a.cpu.instruction_counter() == b.cpu.instruction_counter();
+		for (uint32_t i = 0; i < 32; i++)
+			same = same && a.cpu.reg(i) == b.cpu.reg(i);
+		for (size_t i = 0; i < mem_len; i += 4)
+			same = same && a.memory.template read<uint32_t> (mem_addr + i)
+				== b.memory.template read<uint32_t> (mem_addr + i);
+		if (!same) {
+			fprintf(stderr, "pc 0x%lx vs 0x%lx, counter %lu vs %lu\n",
+				(long) a.cpu.pc(), (long) b.cpu.pc(),
+				(long) a.cpu.instruction_counter(), (long) b.cpu.instruction_counter());
+			for (uint32_t i = 0; i < 32; i++)
+				if (a.cpu.reg(i) != b.cpu.reg(i))
+					fprintf(stderr, "x%u: 0x%lx vs 0x%lx\n", i,
+						(long) a.cpu.reg(i), (long) b.cpu.reg(i));
+		}
+		return same;
+	}
+
+	// Run @machine with the dispatch engine for up to @limit instructions
+	// (0 is until it stops), then step @reference as far with the plain
+	// interpreter, and check that they ended up in the same state. Both
+	// machines have to throw the same exceptions.
+	template <int W>
+	inline void compare_with_interpreter(Machine<W>& machine, Machine<W>& reference,
+		uint64_t limit, address_type<W> mem_addr = 0, size_t mem_len = 0)
+	{
+		int engine_error = -1;
+		try {
+			machine.simulate(limit);
+		} catch (const MachineException& e) {
+			engine_error = e.type();
+		}
+#ifndef RISCV_BATCHED_BUDGET
+		if (limit != 0)
+			assert(machine.cpu.instruction_counter() - reference.cpu.instruction_counter() <= limit);
+#endif
+		int reference_error = -1;
+		try {
+			reference.stop(false);
+			while (!reference.stopped()
+				&& reference.cpu.instruction_counter() < machine.cpu.instruction_counter())
+				reference.cpu.simulate();
+			// the instruction that faulted
+			if (engine_error != -1)
+				reference.cpu.simulate();
+		} catch (const MachineException& e) {
+			reference_error = e.type();
+		}
+		assert(engine_error == reference_error);
+		assert(machine.stopped() == reference.stopped());
+		assert(same_state(machine, reference, mem_addr, mem_len));
+	}
+
+	template <int W>
+	inline void compare_with_interpreter(const std::vector<uint8_t>& binary,
+		uint64_t limit = 0, address_type<W> mem_addr = 0, size_t mem_len = 0,
+		MachineOptions<W> options = {})
+	{
+		auto machine = testable_machine<W>(binary, options);
+		auto reference = testable_machine<W>(binary, options);
+		compare_with_interpreter(*machine, *reference, limit, mem_addr, mem_len);
+	}
+}